@@ -0,0 +1,14 @@
+/*
+ * host/avr/interrupt.h - single-threaded host build: no interrupts to mask.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define cli() ((void)0)
+#define sei() ((void)0)
+#define ISR(vector, ...) void vector(void)
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,49 @@
+/*
+ * host/avr/io.h - stand-in for <avr/io.h> when building firmware sources on the PC.
+ * Only what the benchmarked modules touch is provided.
+ */
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+/* registers touched by motors.c; step_drift.c defines and clocks them */
+extern volatile uint8_t  SREG, GTCCR;
+extern volatile uint8_t  TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+extern volatile uint8_t  TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+extern volatile uint16_t OCR1A, OCR1B, TCNT1, OCR3A, TCNT3;
+extern volatile uint8_t  DDRB, PORTB, DDRC, PORTC, DDRD, PORTD;
+
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB5     5
+#define PB6     6
+#define PC6     6
+#define PD4     4
+#define PD6     6
+#define PD7     7
+
+#define CS10    0
+#define CS11    1
+#define CS12    2
+#define WGM12   3
+#define COM1A0  6
+#define FOC1A   7
+#define OCIE1A  1
+#define CS30    0
+#define CS31    1
+#define CS32    2
+#define WGM32   3
+#define COM3A0  6
+#define FOC3A   7
+#define OCIE3A  1
+#define PSRSYNC 0
+#define TSM     7
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,14 @@
+/*
+ * host/avr/pgmspace.h - flash tables are ordinary const data on the PC.
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_word(p)  (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
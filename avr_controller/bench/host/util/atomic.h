@@ -0,0 +1,12 @@
+/*
+ * host/util/atomic.h - ATOMIC_BLOCK runs its body once, nothing to protect on the host.
+ */
+
+#ifndef HOST_UTIL_ATOMIC_H_
+#define HOST_UTIL_ATOMIC_H_
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON      0
+#define ATOMIC_BLOCK(type)  for (int _atomic_once = 1; _atomic_once; _atomic_once = 0)
+
+#endif /* HOST_UTIL_ATOMIC_H_ */
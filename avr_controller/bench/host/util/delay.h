@@ -0,0 +1,11 @@
+/*
+ * host/util/delay.h - busy-wait delays compile to nothing on the host.
+ */
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+static inline void _delay_ms(double ms) { (void)ms; }
+static inline void _delay_us(double us) { (void)us; }
+
+#endif /* HOST_UTIL_DELAY_H_ */
@@ -0,0 +1,88 @@
+/* -----------------------------------------------------------------------------
+ * motors_cost.c  Host timing of motors_update()
+ *
+ * Links src/motors.c unchanged (timers are plain memory here, so no ISR runs)
+ * and times motors_update() over three kinds of tick:
+ *   start   first tick out of standstill (ramp start values computed)
+ *   run     running, speed and turn rate changing every tick
+ *   brake   ramping down to zero
+ * Each figure is the mean over REPS calls.  Host nanoseconds only rank code
+ * paths; AVR cycle estimates are in the README.
+ *
+ *   usage: motors_cost
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#define _POSIX_C_SOURCE 199309L
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "motors.h"
+
+#define REPS 200000U
+
+volatile uint8_t  SREG, GTCCR;
+volatile uint8_t  TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+volatile uint8_t  TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+volatile uint16_t OCR1A, OCR1B, TCNT1, OCR3A, TCNT3;
+volatile uint8_t  DDRB, PORTB, DDRC, PORTC, DDRD, PORTD;
+
+static inline double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double time_start(void)
+{
+	double ns = 0.0;
+	for (unsigned i = 0; i < REPS; i++)
+	{
+		motors_stop_all();
+		float v = 50.0f + (float)(i % 500);
+		double t0 = now_ns();
+		motors_update(v, 0.1f * (float)(i % 300) - 15.0f);
+		ns += now_ns() - t0;
+	}
+	return ns / REPS;
+}
+
+static double time_run(void)
+{
+	motors_stop_all();
+	motors_update(300.0f, 0.0f);
+
+	double t0 = now_ns();
+	for (unsigned i = 0; i < REPS; i++)
+		motors_update(300.0f + (float)(i % 400), 0.1f * (float)(i % 300) - 15.0f);
+	return (now_ns() - t0) / REPS;
+}
+
+static double time_brake(void)
+{
+	double ns = 0.0;
+	for (unsigned i = 0; i < REPS; i++)
+	{
+		motors_update(400.0f, 5.0f);
+		double t0 = now_ns();
+		motors_update(400.0f - 4.0f * (float)(i % 100), 5.0f);
+		ns += now_ns() - t0;
+	}
+	return ns / REPS;
+}
+
+int main(void)
+{
+	motors_init();
+
+	double s = time_start();
+	double r = time_run();
+	double b = time_brake();
+	double worst = s > r ? (s > b ? s : b) : (r > b ? r : b);
+
+	printf("motors_update  start %.1f ns  run %.1f ns  brake %.1f ns  worst %.1f ns\n", s, r, b, worst);
+	return 0;
+}
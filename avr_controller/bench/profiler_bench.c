@@ -0,0 +1,188 @@
+/* -----------------------------------------------------------------------------
+ * profiler_bench.c  Off-target accuracy / cost benchmark for profiler.c
+ *
+ * Runs the real profile_start()/motion_update() against sim_plant.c over a
+ * sweep of distances, top speeds, accelerations and loop-period jitter and
+ * reports, per case:
+ *   end   endpoint error       encoder distance at completion - target  [mm]
+ *   pk    peak-speed error     max commanded speed - predicted peak      [mm/s]
+ *   ovs   overshoot            max encoder distance - target, >= 0       [mm]
+ *   dT    completion error     time to PE_MOTION_COMPLETE - plan total   [s]
+ *   ns    cost                 host ns per motion_update()
+ *
+ *   usage: profiler_bench [-q] [-s 0|1] [-n seed]
+ *          -q  summary only      -s  settling off/on (default on)
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#define _POSIX_C_SOURCE 199309L
+#include "config.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "profiler.h"
+#include "sim_plant.h"
+
+#define TICK_US      (LOOP_TIME * 1000U)
+#define MAX_SIM_S    60.0f
+
+static const float distances[] = { 50.0f, 200.0f, 1000.0f, 5000.0f };
+static const float speeds[]    = { 100.0f, 300.0f, 600.0f };
+static const float accels[]    = { 100.0f, 500.0f, 2000.0f };
+static const uint32_t jitters[] = { 0U, 1000U, 3000U };      /* +/- us on the 10 ms tick */
+
+#define N_ELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+	float end_err;
+	float peak_err;
+	float overshoot;
+	float time_err;
+	float settle_time;
+	double ns_per_update;
+	bool  completed;
+} CaseResult;
+
+static bool complete;
+static void on_event(ProfileEvent ev, const Profile *p)
+{
+	(void)p;
+	if (ev == PE_MOTION_COMPLETE)
+		complete = true;
+}
+
+/* deterministic jitter source, independent of the host libc */
+static uint32_t rng_state = 1U;
+static uint32_t rng_next(void)
+{
+	rng_state = rng_state * 1664525U + 1013904223U;
+	return rng_state >> 8;
+}
+
+static uint32_t jittered_tick(uint32_t jitter)
+{
+	if (jitter == 0U)
+		return TICK_US;
+	return TICK_US - jitter + rng_next() % (2U * jitter + 1U);
+}
+
+static inline double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static CaseResult run_case(float dist, float top, float acc, uint32_t jitter)
+{
+	extern MotionType motionType;
+	CaseResult res = {0};
+
+	plant_reset();
+	motion_reset_drive_system();
+	plant_step(0.0f, 0.0f, TICK_US); /* first real dt, as after the firmware's first tick */
+
+	complete = false;
+	motion_start_move(dist, top, 0.0f, acc);
+	const ProfilePlan plan = *motion_move_plan();
+
+	float t = 0.0f, peak = 0.0f, max_pos = 0.0f;
+	double ns = 0.0;
+	uint32_t updates = 0;
+
+	while (!complete && t < MAX_SIM_S)
+	{
+		uint32_t dt = jittered_tick(jitter);
+		plant_step(motion_velocity(), motion_omega(), dt);
+		t += dt * 1e-6f;
+
+		double t0 = now_ns();
+		motion_update();
+		ns += now_ns() - t0;
+		updates++;
+
+		peak = fmaxf(peak, fabsf(motion_velocity()));
+		max_pos = fmaxf(max_pos, plant_distance_mm());
+	}
+
+	/* let the wheels come to rest before measuring the endpoint */
+	for (int i = 0; i < 50; i++)
+		plant_step(0.0f, 0.0f, TICK_US);
+
+	res.completed = complete;
+	res.end_err = plant_distance_mm() - dist;
+	res.peak_err = peak - plan.peak_speed;
+	res.overshoot = fmaxf(0.0f, max_pos - dist);
+	res.time_err = t - plan.total_time;
+	res.settle_time = motionType.forward.settle_time;
+	res.ns_per_update = updates ? ns / updates : 0.0;
+	return res;
+}
+
+int main(int argc, char **argv)
+{
+	bool quiet = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-q") == 0)
+			quiet = true;
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			motion_set_settling(atoi(argv[++i]) != 0);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			rng_state = (uint32_t)strtoul(argv[++i], 0, 0);
+		else
+		{
+			fprintf(stderr, "usage: %s [-q] [-s 0|1] [-n seed]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	motion_set_event_handler(on_event);
+
+	if (!quiet)
+		printf("%7s %5s %5s %5s | %8s %8s %7s %7s %6s %7s\n",
+		       "dist", "vmax", "acc", "jit", "end[mm]", "pk[mm/s]", "ovs[mm]", "dT[s]", "ts[s]", "ns/upd");
+
+	unsigned cases = 0, failed = 0;
+	float worst_end = 0.0f, worst_pk = 0.0f, worst_ovs = 0.0f, worst_dt = 0.0f;
+	double sum_end = 0.0, sum_ns = 0.0, max_ns = 0.0;
+
+	for (unsigned d = 0; d < N_ELEM(distances); d++)
+		for (unsigned v = 0; v < N_ELEM(speeds); v++)
+			for (unsigned a = 0; a < N_ELEM(accels); a++)
+				for (unsigned j = 0; j < N_ELEM(jitters); j++)
+				{
+					CaseResult r = run_case(distances[d], speeds[v], accels[a], jitters[j]);
+					cases++;
+					if (!r.completed)
+						failed++;
+
+					worst_end = fmaxf(worst_end, fabsf(r.end_err));
+					worst_pk = fmaxf(worst_pk, fabsf(r.peak_err));
+					worst_ovs = fmaxf(worst_ovs, r.overshoot);
+					worst_dt = fmaxf(worst_dt, fabsf(r.time_err));
+					sum_end += fabsf(r.end_err);
+					sum_ns += r.ns_per_update;
+					if (r.ns_per_update > max_ns)
+						max_ns = r.ns_per_update;
+
+					if (!quiet)
+						printf("%7.0f %5.0f %5.0f %5u | %+8.3f %+8.2f %7.3f %+7.3f %6.3f %7.1f%s\n",
+						       distances[d], speeds[v], accels[a], jitters[j],
+						       r.end_err, r.peak_err, r.overshoot, r.time_err, r.settle_time,
+						       r.ns_per_update, r.completed ? "" : "  TIMEOUT");
+				}
+
+	printf("cases %u  timeouts %u\n", cases, failed);
+	printf("endpoint  |err| mean %.3f mm  worst %.3f mm\n", sum_end / cases, worst_end);
+	printf("peak speed worst %.2f mm/s   overshoot worst %.3f mm   completion worst %.3f s\n",
+	       worst_pk, worst_ovs, worst_dt);
+	printf("motion_update  mean %.1f ns  worst-case mean %.1f ns\n", sum_ns / cases, max_ns);
+
+	return failed ? 1 : 0;
+}
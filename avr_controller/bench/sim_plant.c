@@ -0,0 +1,104 @@
+/* -----------------------------------------------------------------------------
+ * sim_plant.c  Differential-drive plant + encoder/motor stubs for host builds
+ *
+ * Each wheel follows its commanded tangential speed with a first-order lag,
+ * positions are quantised to encoder pulses exactly like encoder.c counts them.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include "config.h"
+#include <math.h>
+#include <stdbool.h>
+#include "encoder.h"
+#include "motors.h"
+#include "sim_plant.h"
+
+#define MM_PER_PULSE (MM_PER_ROTATION / (4.0 * ENCODER_PPR * GEAR_RATIO))
+
+/* plant state (true wheel motion) */
+static double left_mm, right_mm;     /* absolute since plant_reset() */
+static double left_v, right_v;       /* mm/s */
+
+/* odometry state (what encoder.c would report) */
+static int32_t left_cnt, right_cnt, prev_left_cnt, prev_right_cnt;
+static int32_t left_delta, right_delta;
+static float fwd_change_mm, rot_change_deg;
+static float robot_distance_mm, robot_angle_deg;
+static uint32_t loop_dt_us = 1;
+static bool drivers_enabled = true;
+
+static inline float inv_dt(void) { return 1e6f / (float)loop_dt_us; }
+
+/* ====================  plant =================== */
+void plant_reset(void)
+{
+	left_mm = right_mm = 0.0;
+	left_v = right_v = 0.0;
+	left_cnt = right_cnt = 0;
+	encoder_odometry_reset();
+}
+
+void plant_step(float velocity, float omega, uint32_t dt_us)
+{
+	/* same feed-forward split as motors_update() */
+	double tangent = omega * WHEEL_BASE_MM * M_PI / 360.0;
+	double cmd_l = drivers_enabled ? velocity - tangent : 0.0;
+	double cmd_r = drivers_enabled ? velocity + tangent : 0.0;
+
+	double dt = dt_us * 1e-6;
+	double k = 1.0 - exp(-dt / PLANT_TAU_S);
+	double l0 = left_v, r0 = right_v;
+	left_v += (cmd_l - left_v) * k;
+	right_v += (cmd_r - right_v) * k;
+	left_mm += 0.5 * (l0 + left_v) * dt;
+	right_mm += 0.5 * (r0 + right_v) * dt;
+
+	left_cnt = (int32_t)floor(left_mm / MM_PER_PULSE);
+	right_cnt = (int32_t)floor(right_mm / MM_PER_PULSE);
+
+	loop_dt_us = dt_us ? dt_us : 1;
+	left_delta = left_cnt - prev_left_cnt;
+	right_delta = right_cnt - prev_right_cnt;
+	prev_left_cnt = left_cnt;
+	prev_right_cnt = right_cnt;
+
+	float l = left_delta * (float)MM_PER_PULSE;
+	float r = right_delta * (float)MM_PER_PULSE;
+	fwd_change_mm = 0.5f * (l + r);
+	rot_change_deg = (r - l) * DEG_PER_MM_DIFF;
+	robot_distance_mm += fwd_change_mm;
+	robot_angle_deg += rot_change_deg;
+}
+
+float plant_distance_mm(void) { return robot_distance_mm; }
+float plant_angle_deg(void) { return robot_angle_deg; }
+float plant_speed_mm_s(void) { return (float)(0.5 * (left_v + right_v)); }
+float plant_omega_dps(void) { return (float)((right_v - left_v) * DEG_PER_MM_DIFF); }
+
+/* ====================  encoder.h stubs =================== */
+int32_t encoder_get_left(void) { return left_cnt; }
+int32_t encoder_get_right(void) { return right_cnt; }
+
+void encoder_odometry_reset(void)
+{
+	prev_left_cnt = left_cnt;
+	prev_right_cnt = right_cnt;
+	left_delta = right_delta = 0;
+	fwd_change_mm = rot_change_deg = 0.0f;
+	robot_distance_mm = robot_angle_deg = 0.0f;
+	loop_dt_us = 1;
+}
+
+float encoder_left_speed_mm_s(void) { return left_delta * (float)MM_PER_PULSE * inv_dt(); }
+float encoder_right_speed_mm_s(void) { return right_delta * (float)MM_PER_PULSE * inv_dt(); }
+float encoder_robot_speed_mm_s(void) { return fwd_change_mm * inv_dt(); }
+float encoder_robot_omega_dps(void) { return rot_change_deg * inv_dt(); }
+float encoder_robot_distance_mm(void) { return robot_distance_mm; }
+float encoder_robot_angle_deg(void) { return robot_angle_deg; }
+uint32_t encoder_loop_time_us(void) { return loop_dt_us; }
+
+/* ====================  motors.h stubs =================== */
+void motors_enable_all(bool en) { drivers_enabled = en; }
+void motors_stop_all(void) { drivers_enabled = false; }
+void motors_reset_steps(void) { }
@@ -0,0 +1,26 @@
+/*
+ * sim_plant.h
+ *
+ * Host-side differential-drive plant standing in for encoder.c / motors.c,
+ * so profiler.c can run unchanged on the PC.
+ *  Author: Endeavor360
+ */
+
+#ifndef SIM_PLANT_H_
+#define SIM_PLANT_H_
+
+#include <stdint.h>
+
+#define PLANT_TAU_S 0.010f /* wheel speed lag behind the step command */
+
+void  plant_reset(void);
+
+/* advance dt_us with the given command, then latch odometry like encoder_odometry_update() */
+void  plant_step(float velocity, float omega, uint32_t dt_us);
+
+float plant_distance_mm(void);  /* encoder-quantised, since the last odometry reset */
+float plant_angle_deg(void);
+float plant_speed_mm_s(void);   /* true (unquantised) forward speed */
+float plant_omega_dps(void);
+
+#endif /* SIM_PLANT_H_ */
@@ -0,0 +1,268 @@
+/* -----------------------------------------------------------------------------
+ * step_drift.c  Off-target step-rate accuracy / straight-line drift for motors.c
+ *
+ * Links src/motors.c unchanged and clocks its CTC master step timer cycle-exact
+ * on the PC: every compare match calls the real compare ISR, every 10 ms the
+ * real motors_update() is called with a constant command.  After a 2 s
+ * run-up the emitted steps are counted and compared with the requested
+ * rates:
+ *   L/R   per-wheel step-rate error over RATE_S seconds          [ppm]
+ *   hdg   heading error at the end of the first STEADY_S seconds [deg]
+ *   lat   lateral drift from that heading error over STEADY_S    [mm]
+ * A whole step in the count is 54 ppm of 97 mm/s at 200 pulses/rev over
+ * STEADY_S, so the rates are taken over the longer RATE_S window.
+ *   cnt   step count minus where a DRV8825-style indexer, fed from the
+ *         PUL/DIR/MS pins, actually is, over the whole case      [microsteps]
+ * The run-up passes through the microstep bands, so cnt checks the count
+ * across band changes.
+ *
+ *   usage: step_drift [-q]
+ *          -q  summary only
+ * Built three times by the Makefile: with TOP dithering (default
+ * STEP_DITHER_PPM), with plain rounding (step_drift_round) for comparison,
+ * and with the MS-pin bands (step_drift_bands).
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include "config.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motors.h"
+
+#define TICK_CYCLES  ((uint64_t)F_CPU * LOOP_TIME / 1000U)
+#define RUNUP_S      2U
+#define STEADY_S     60U
+#define RATE_S       3600U
+
+#define N_ELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+/* the hardware motors.c drives ------------------------------------------- */
+volatile uint8_t  SREG, GTCCR;
+volatile uint8_t  TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+volatile uint8_t  TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+volatile uint16_t OCR1A, OCR1B, TCNT1, OCR3A, TCNT3;
+volatile uint8_t  DDRB, PORTB, DDRC, PORTC, DDRD, PORTD;
+
+void TIMER1_COMPA_vect(void);
+
+static const uint8_t cs_shift[8] = { 0, 0, 3, 6, 8, 10, 0, 0 };
+
+typedef struct {
+	volatile uint8_t  *tccrb;
+	volatile uint16_t *ocr;
+	volatile uint16_t *tcnt;
+	void (*isr)(void);
+	uint64_t base;      /* cycle at which TCNT held tcnt0 */
+	uint16_t tcnt0;
+	uint64_t next;      /* cycle of the next compare match, UINT64_MAX = stopped */
+} SimTimer;
+
+static SimTimer sim_master = { &TCCR1B, &OCR1A, &TCNT1, TIMER1_COMPA_vect };
+
+/* the drivers: step on the falling PUL edge to the next valid state of the
+   mode on the MS pins ------------------------------------------------------ */
+typedef struct {
+	uint8_t micro;
+	uint8_t ms;
+	float   max_mm_s;
+} SimBand;
+
+#if STEP_MS_PINS
+static const SimBand sim_bands[] = STEP_BANDS;
+#else
+static const SimBand sim_bands[] = { { STEP_MICRO_MAX, 0, 0.0f } };
+#endif
+
+typedef struct {
+	volatile uint8_t *pul_port;
+	volatile uint8_t *dir_port;
+	uint8_t  pul_mask;
+	uint8_t  dir_mask;
+	bool     fwd_level;
+	bool     pul_low;
+	int32_t  pos;       /* finest microsteps, + = wheel forward */
+} SimDriver;
+
+static SimDriver drv_left  = { &LEFT_PUL_PORT,  &LEFT_DIR_PORT,  _BV(LEFT_PUL_BIT),  _BV(LEFT_DIR_BIT),  true,  false, 0 };
+static SimDriver drv_right = { &RIGHT_PUL_PORT, &RIGHT_DIR_PORT, _BV(RIGHT_PUL_BIT), _BV(RIGHT_DIR_BIT), false, false, 0 };
+
+static uint8_t sim_microsteps(void)
+{
+#if STEP_MS_PINS
+	for (unsigned i = 0; i < N_ELEM(sim_bands); i++)
+		if ((STEP_MS_PORT & STEP_MS_MASK) == sim_bands[i].ms)
+			return sim_bands[i].micro;
+#endif
+	return sim_bands[0].micro;
+}
+
+static void driver_sample(SimDriver *d)
+{
+	bool low = !(*d->pul_port & d->pul_mask);
+	if (low && !d->pul_low)
+	{
+		int32_t inc = STEP_MICRO_MAX / sim_microsteps();
+		int32_t off = ((d->pos % inc) + inc) % inc;
+		bool fwd = ((*d->dir_port & d->dir_mask) != 0) == d->fwd_level;
+		d->pos += fwd ? inc - off : -(off ? off : inc);
+	}
+	d->pul_low = low;
+}
+
+/* make TCNT what the firmware would read at cycle now */
+static void timer_sync(SimTimer *t, uint64_t now)
+{
+	uint8_t cs = *t->tccrb & STEP_TIMER_CS_MASK;
+	if (cs)
+		*t->tcnt = (uint16_t)(t->tcnt0 + ((now - t->base) >> cs_shift[cs]));
+}
+
+/* firmware may have touched OCR / TCNT / CS: work out the next match */
+static void timer_resched(SimTimer *t, uint64_t now)
+{
+	uint8_t cs = *t->tccrb & STEP_TIMER_CS_MASK;
+	if (!cs)
+	{
+		t->next = UINT64_MAX;
+		return;
+	}
+	t->base = now;
+	t->tcnt0 = *t->tcnt;
+	uint32_t ticks = (*t->ocr >= t->tcnt0) ? (uint32_t)(*t->ocr - t->tcnt0) + 1U
+	                                       : 0x10000UL - t->tcnt0 + *t->ocr + 1U;
+	t->next = now + ((uint64_t)ticks << cs_shift[cs]);
+}
+
+/* CTC compare: counter clears, ISR runs */
+static void timer_fire(SimTimer *t)
+{
+	uint64_t now = t->next;
+	*t->tcnt = 0;
+	t->base = now;
+	t->tcnt0 = 0;
+	t->isr();
+	timer_resched(t, now);
+}
+
+static void drivers_sample(void)
+{
+	driver_sample(&drv_left);
+	driver_sample(&drv_right);
+}
+
+static void run_until(uint64_t end)
+{
+	while (sim_master.next <= end)
+	{
+		timer_fire(&sim_master);
+		drivers_sample();
+	}
+}
+
+static void control_tick(uint64_t now, float v, float w)
+{
+	timer_sync(&sim_master, now);
+	motors_update(v, w);
+	drivers_sample();
+	timer_resched(&sim_master, now);
+}
+
+typedef struct {
+	double ppm_left;
+	double ppm_right;
+	double hdg_deg;
+	double lat_mm;
+	int32_t cnt;
+} DriftResult;
+
+static DriftResult run_case(float v, float w)
+{
+	DriftResult res;
+	uint64_t now = 0;
+
+	motors_stop_all();
+	motors_reset_steps();
+	drivers_sample();
+	sim_master.next = UINT64_MAX;
+	int32_t pl = drv_left.pos, pr = drv_right.pos;
+
+	for (unsigned i = 0; i < RUNUP_S * 1000U / LOOP_TIME; i++, now += TICK_CYCLES)
+	{
+		control_tick(now, v, w);
+		run_until(now + TICK_CYCLES);
+	}
+
+	int32_t l0 = motors_get_steps_left(), r0 = motors_get_steps_right();
+	for (unsigned i = 0; i < STEADY_S * 1000U / LOOP_TIME; i++, now += TICK_CYCLES)
+	{
+		control_tick(now, v, w);
+		run_until(now + TICK_CYCLES);
+	}
+	double dl = motors_get_steps_left() - l0;
+	double dr = motors_get_steps_right() - r0;
+
+	/* same wheel split as motors_update(), steps/s */
+	double tangent = w * WHEEL_BASE_MM * M_PI / 360.0;
+	double want_l = (v - tangent) * STEPS_PER_MM;
+	double want_r = (v + tangent) * STEPS_PER_MM;
+
+	res.hdg_deg = ((dr - dl) - (want_r - want_l) * STEADY_S) / STEPS_PER_MM * DEG_PER_MM_DIFF;
+	res.lat_mm = 0.5 * res.hdg_deg * (M_PI / 180.0) * v * STEADY_S; /* heading error grows linearly */
+
+	for (unsigned i = STEADY_S * 1000U / LOOP_TIME; i < RATE_S * 1000U / LOOP_TIME; i++, now += TICK_CYCLES)
+	{
+		control_tick(now, v, w);
+		run_until(now + TICK_CYCLES);
+	}
+	dl = motors_get_steps_left() - l0;
+	dr = motors_get_steps_right() - r0;
+	res.ppm_left = (dl - want_l * RATE_S) / (want_l * RATE_S) * 1e6;
+	res.ppm_right = (dr - want_r * RATE_S) / (want_r * RATE_S) * 1e6;
+
+	int32_t cl = motors_get_steps_left() - (drv_left.pos - pl);
+	int32_t cr = motors_get_steps_right() - (drv_right.pos - pr);
+	res.cnt = (abs(cl) > abs(cr)) ? cl : cr;
+	return res;
+}
+
+static const float speeds[] = { 97.0f, 250.0f, 413.0f, 650.0f, 901.0f };
+static const float omegas[] = { 0.0f, 0.05f, 0.37f };
+
+int main(int argc, char **argv)
+{
+	bool quiet = (argc > 1 && strcmp(argv[1], "-q") == 0);
+
+	motors_init();
+
+	printf("STEP_DITHER_PPM %lu  STEP_MICRO_MAX %u  window %u s (rates %u s)\n",
+	       (unsigned long)STEP_DITHER_PPM, (unsigned)STEP_MICRO_MAX, STEADY_S, RATE_S);
+	if (!quiet)
+		printf("%6s %6s | %9s %9s %9s %9s %5s\n", "v", "w", "L[ppm]", "R[ppm]", "hdg[deg]", "lat[mm]", "cnt");
+
+	double worst_ppm = 0.0, worst_hdg = 0.0, worst_lat = 0.0;
+	int32_t worst_cnt = 0;
+
+	for (unsigned i = 0; i < N_ELEM(speeds); i++)
+		for (unsigned j = 0; j < N_ELEM(omegas); j++)
+		{
+			DriftResult r = run_case(speeds[i], omegas[j]);
+			worst_ppm = fmax(worst_ppm, fmax(fabs(r.ppm_left), fabs(r.ppm_right)));
+			worst_hdg = fmax(worst_hdg, fabs(r.hdg_deg));
+			worst_lat = fmax(worst_lat, fabs(r.lat_mm));
+			if (abs(r.cnt) > worst_cnt)
+				worst_cnt = abs(r.cnt);
+
+			if (!quiet)
+				printf("%6.0f %6.2f | %+9.1f %+9.1f %+9.4f %+9.2f %+5ld\n",
+				       speeds[i], omegas[j], r.ppm_left, r.ppm_right, r.hdg_deg, r.lat_mm, (long)r.cnt);
+		}
+
+	printf("rate error worst %.1f ppm   heading worst %.4f deg   lateral drift worst %.2f mm   count vs driver worst %ld\n",
+	       worst_ppm, worst_hdg, worst_lat, (long)worst_cnt);
+	return 0;
+}
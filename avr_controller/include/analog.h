@@ -1,8 +1,8 @@
 /*
- * analog.h  ADC sampler API (header?only stub)
+ * analog.h  ADC sampler API
  * -----------------------------------------
- * Placeholder prototypes for IR distance and battery monitor helpers.
- * Implement the definitions in adc.c later.
+ * The ADC ISR scans the ADC_SCAN channels round robin and keeps a running
+ * average per channel; the getters only read the latest value.
  */
 
 #ifndef ANALOG_H_
@@ -10,19 +10,49 @@
 
 #include "config.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 /* initialise hardware (call once at start-up) */
 void     analog_init(void);
 
-/* blocking single-shot read of an arbitrary ADC channel */
+/* latest averaged raw value of a scanned channel (0 if not in ADC_SCAN) */
 uint16_t analog_read_raw(uint8_t channel);
 
+/* once per loop tick: steps the battery filters */
+void     analog_update(void);
+
 /* helpers that deliver already-scaled values -------------*/
+/* filtered battery voltage (fast on a drop, slow on a rise);
+   0 until the first analog_update()                          */
 uint16_t analog_get_battery_1_mV(void);
 uint16_t analog_get_battery_2_mV(void);
 
-uint16_t analog_get_cliff_left(void);
-uint16_t analog_get_cliff_front(void);
-uint16_t analog_get_cliff_right(void);
+/* cliff sensor distances [mm], linearised (sharp.h) */
+uint16_t analog_get_cliff_left_mm(void);
+uint16_t analog_get_cliff_front_mm(void);
+uint16_t analog_get_cliff_right_mm(void);
+
+/* cliff fast stop -----------------------------------------*/
+#define CLIFF_LEFT   0x01
+#define CLIFF_FRONT  0x02
+#define CLIFF_RIGHT  0x04
+
+typedef struct
+{
+	uint8_t  side;     /* CLIFF_LEFT | CLIFF_FRONT | CLIFF_RIGHT      */
+	uint32_t t_us;     /* micros32() when the ISR braked              */
+	uint16_t raw;      /* the average that crossed the threshold [counts] */
+} CliffEvent;
+
+/* distance thresholds [mm], 0 = not watched; a channel arms once it reads
+   at or within its distance, so setting one over a cliff does not trip it.
+   Values are kept just inside SHARP_MM_MIN..SHARP_MM_MAX; the getter
+   returns what is in effect.                                             */
+void     analog_cliff_set(uint16_t left, uint16_t front, uint16_t right);
+uint16_t analog_cliff_threshold(uint8_t slot);
+
+bool     analog_cliff_take(CliffEvent *e); /* true once per trip, main loop */
+bool     analog_cliff_fault(void);         /* latched until analog_cliff_clear() */
+void     analog_cliff_clear(void);
 
 #endif /* ANALOG_H_ */
\ No newline at end of file
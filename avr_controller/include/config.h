@@ -23,13 +23,13 @@
 // Steps per revolution (full-step mode)
 #define STEPS_PER_REV 200U
 
-/* ---------- LEFT motor (M1)  now on Timer-3 / OC3A (PC6 / Arduino D5) ---------- */
+/* ---------- LEFT motor (M1)  PUL on PC6 / Arduino D5 (software pulse) ---------- */
 //  PUL- -> D5  = PC6 / OC3A
 //  DIR- -> D12 = PD6
 //  ENA- -> D10 = PB6   (active-HIGH in inverted logic)
 #define LEFT_PUL_DDR   DDRC
 #define LEFT_PUL_PORT  PORTC
-#define LEFT_PUL_BIT   PC6   /* OC3A */
+#define LEFT_PUL_BIT   PC6
 
 #define LEFT_DIR_DDR   DDRD
 #define LEFT_DIR_PORT  PORTD
@@ -55,16 +55,126 @@
 #define RIGHT_ENA_PORT  PORTD
 #define RIGHT_ENA_BIT   PD7  
 
+/* ---------- REAR motors (four-wheel bases only, see DRIVE_KINEMATICS) ---------- */
+//  rear-left   PUL- -> D15/SCK  = PB1,  DIR- -> D16/MOSI = PB2,   ENA- shared with LEFT
+//  rear-right  PUL- -> D14/MISO = PB3,  DIR- -> RXLED    = PB0,   ENA- shared with RIGHT
+//  Every other GPIO is taken, so the rear axes use the ICSP pins (the MS lines
+//  are then unavailable, STEP_MS_PINS 0) and one LED line. Pins to keep clear:
+//    PE2 (HWB)  - held low at reset with the HWB fuse set, the board boots into
+//                 the bootloader; never wire it to a driver input.
+//    PC7 (LED, OC4A), PD5 (TXLED) - the on-board LEDs load them, and the
+//                 bootloader drives them.
+//  PB0 is only used for a DIR line: the bootloader blinks RXLED while it runs,
+//  and DIR toggling with no pulses does not move the wheel. Disable the drivers
+//  (ENA) before ISP programming, as SCK and MISO carry rear-axis pulses.
+#define REAR_LEFT_PUL_DDR    DDRB
+#define REAR_LEFT_PUL_PORT   PORTB
+#define REAR_LEFT_PUL_BIT    PB1
+
+#define REAR_LEFT_DIR_DDR    DDRB
+#define REAR_LEFT_DIR_PORT   PORTB
+#define REAR_LEFT_DIR_BIT    PB2
+
+#define REAR_RIGHT_PUL_DDR   DDRB
+#define REAR_RIGHT_PUL_PORT  PORTB
+#define REAR_RIGHT_PUL_BIT   PB3
+
+#define REAR_RIGHT_DIR_DDR   DDRB
+#define REAR_RIGHT_DIR_PORT  PORTB
+#define REAR_RIGHT_DIR_BIT   PB0
+
 #ifndef _BV //this is just to silence the shitty linter in microchip studio
 #define _BV(bit) (1 << (bit))
 #endif
 
-/* ------------------- timer prescaler / clock divisors --------------------------- */
-#define CLOCK_DIVISOR_TIMER1          1024U
-#define PRE_SCALE_TIMER1       (_BV(CS12) | _BV(CS10))
+/* ------------------- master step clock (Timer-1, CTC) ----------------- */
+/* Both PUL pins are driven from the Timer-1 compare-A ISR; compare B paces the
+   ADC (analog.c). Timer-3 is the time base (systime.c).                      */
+/* The prescaler is picked per speed: the finest of /1 /8 /64 /256 /1024 whose
+   TOP still fits 16 bits, so the step period resolution is 62.5 ns at speed
+   instead of a fixed 64 us.                                                   */
+#define STEP_TIMER_CS_MASK     0x07U             /* CSn2:0 in TCCRnB           */
+#define STEP_HALF_PERIOD_MAX   (0x10000UL << 8)  /* longest toggle period, /256 [cycles] */
+#define STEP_C_FRAC_BITS       6                 /* fraction bits of the ramp's period    */
+#ifndef STEP_DITHER_PPM                          /* (bench/step_drift builds a no-dither variant) */
+#define STEP_DITHER_PPM        2UL               /* dither TOP when rounding is worse than this */
+#endif
+
+/* ------------------- drive kinematics / step axes ----------------------- */
+/* motors_update() turns the body command into wheel rates for one of: */
+#define DRIVE_DIFF             0   /* two wheels, axes 0-1                             */
+#define DRIVE_SKID             1   /* four wheels, both wheels of a side at one speed  */
+#define DRIVE_MECANUM          2   /* four mecanum wheels (X rollers), vy sideways     */
+#define DRIVE_KINEMATICS       DRIVE_DIFF
+
+/* Step axes, all clocked by the one master ISR (up to 4): PUL, DIR and ENA
+   pins and the DIR level that drives the wheel forward. Even axes are the
+   left side, odd ones the right; the encoders sit on axes 0 and 1.          */
+#define STEP_PIN(ddr, port, bit)  { &(ddr), &(port), _BV(bit) }
+#define STEP_AXIS_LEFT       { STEP_PIN(LEFT_PUL_DDR, LEFT_PUL_PORT, LEFT_PUL_BIT),                 \
+                               STEP_PIN(LEFT_DIR_DDR, LEFT_DIR_PORT, LEFT_DIR_BIT),                 \
+                               STEP_PIN(LEFT_ENA_DDR, LEFT_ENA_PORT, LEFT_ENA_BIT),   true  }
+#define STEP_AXIS_RIGHT      { STEP_PIN(RIGHT_PUL_DDR, RIGHT_PUL_PORT, RIGHT_PUL_BIT),              \
+                               STEP_PIN(RIGHT_DIR_DDR, RIGHT_DIR_PORT, RIGHT_DIR_BIT),              \
+                               STEP_PIN(RIGHT_ENA_DDR, RIGHT_ENA_PORT, RIGHT_ENA_BIT), false }
+#define STEP_AXIS_REAR_LEFT  { STEP_PIN(REAR_LEFT_PUL_DDR, REAR_LEFT_PUL_PORT, REAR_LEFT_PUL_BIT),  \
+                               STEP_PIN(REAR_LEFT_DIR_DDR, REAR_LEFT_DIR_PORT, REAR_LEFT_DIR_BIT),  \
+                               STEP_PIN(LEFT_ENA_DDR, LEFT_ENA_PORT, LEFT_ENA_BIT),   true  }
+#define STEP_AXIS_REAR_RIGHT { STEP_PIN(REAR_RIGHT_PUL_DDR, REAR_RIGHT_PUL_PORT, REAR_RIGHT_PUL_BIT), \
+                               STEP_PIN(REAR_RIGHT_DIR_DDR, REAR_RIGHT_DIR_PORT, REAR_RIGHT_DIR_BIT), \
+                               STEP_PIN(RIGHT_ENA_DDR, RIGHT_ENA_PORT, RIGHT_ENA_BIT), false }
+
+#if DRIVE_KINEMATICS == DRIVE_DIFF
+#define STEP_AXES  { STEP_AXIS_LEFT, STEP_AXIS_RIGHT }
+#else  /* front-left, front-right, rear-left, rear-right */
+#define STEP_AXES  { STEP_AXIS_LEFT, STEP_AXIS_RIGHT, STEP_AXIS_REAR_LEFT, STEP_AXIS_REAR_RIGHT }
+#endif
+
+/* ------------------- microstep bands ------------------------------------- */
+/* Step counts, STEPS_PER_MM and all step rates are in microsteps at the finest
+   setting, STEP_MICRO_MAX per full step. The engine picks the band from the
+   master speed: fine at crawl for smooth docking, coarse at speed so the
+   pulse rate stays low. A pulse in a band with k microsteps counts
+   STEP_MICRO_MAX / k. Both drivers share the MS lines (DRV8825 style: after
+   a mode change the next STEP moves to the next valid state of the new mode)
+   on the ICSP pins. The CL57T drivers have no MS inputs: their resolution is
+   set by DIP switch, so the default is STEP_MS_PINS 0 with STEP_MICRO_MAX
+   matching the switches; the table is then ignored and there is one band.
+   Set STEP_MS_PINS 1 only for drivers with MS1-3 wired to the pins below. */
+#ifndef STEP_MS_PINS                             /* (bench/step_drift builds a banded variant) */
+#define STEP_MS_PINS           0
+#endif
+#define STEP_MS_DDR            DDRB
+#define STEP_MS_PORT           PORTB
+#define STEP_MS_MASK           (_BV(PB1) | _BV(PB2) | _BV(PB3))   /* MS1 MS2 MS3 */
+#if STEP_MS_PINS && DRIVE_KINEMATICS != DRIVE_DIFF
+#error "STEP_MS_PINS: PB1..PB3 carry the rear axes on four-wheel bases"
+#endif
+#if STEP_MS_PINS
+#define STEP_MICRO_MAX         16U               /* microsteps per full step, finest band */
+#else
+#define STEP_MICRO_MAX         1U                /* driver pulses/rev / STEPS_PER_REV (DIP switches) */
+#endif
+
+/* finest first; microsteps must be STEP_MICRO_MAX / 2^k                      */
+#define STEP_BANDS  {                                                                   \
+	/* microsteps  MS pin levels                     up to [mm/s]  */              \
+	{ 16,          _BV(PB1) | _BV(PB2) | _BV(PB3),   150.0f },                     \
+	{  4,          _BV(PB2),                          600.0f },                     \
+	{  1,          0,                                   0.0f },  /* no limit */    \
+}
+#define STEP_BAND_HYST         0.1f              /* drop a band 10 % below its limit */
 
-#define CLOCK_DIVISOR_TIMER3   1024U             
-#define PRE_SCALE_TIMER3       (_BV(CS32) | _BV(CS30))
+/* Per-step ramp (compare ISR). The wheel acceleration is taken from the
+   change of the requested rate over one control tick.                       */
+#define STEPS_PER_MM           ((float)STEPS_PER_REV * STEP_MICRO_MAX * GEAR_RATIO / (WHEEL_DIAMETER_MM * M_PI))
+#define STEP_RAMP_MIN_ACC      (200.0f * STEP_MICRO_MAX) /* steps/s^2 - ramp floor at constant speed (200 full steps/s^2) */
+#define STEP_RATE_MIN          (1.0f * STEP_MICRO_MAX)   /* steps/s   - slower requests stop the motor (1 full step/s) */
+/* A wheel that reverses brakes the master to standstill first, then DIR
+   changes and the ramp starts again. Only a wheel turning at most this share
+   of the master rate (before and after, e.g. the inner wheel of a tight arc)
+   flips DIR on the move.                                                    */
+#define STEP_REVERSE_RATIO     0.125f
 
 
 
@@ -161,16 +271,68 @@
 #define ADC_CH_CLIFF_FRONT  5   // PF5   Sharp IR centre
 #define ADC_CH_CLIFF_RIGHT  6   // PF6   Sharp IR right
 
+/* ---------- Scan sequence ------------------------------ *
+ *   The ADC ISR converts these round robin, one channel per
+ *   conversion (~104 us at /128), and keeps a running
+ *   average per slot. While the wheels step, each conversion
+ *   is triggered by Timer-1 compare B, half-way between two
+ *   step edges; at standstill Timer-0 paces it at
+ *   ADC_IDLE_HZ.                                           */
+#define ADC_SLOT_BAT_MAIN     0
+#define ADC_SLOT_BAT_AUX      1
+#define ADC_SLOT_CLIFF_LEFT   2
+#define ADC_SLOT_CLIFF_FRONT  3
+#define ADC_SLOT_CLIFF_RIGHT  4
+#define ADC_SLOT_COUNT        5
+#define ADC_SCAN  {                                         \
+	[ADC_SLOT_BAT_MAIN]    = ADC_CH_BAT_MAIN,               \
+	[ADC_SLOT_BAT_AUX]     = ADC_CH_BAT_AUX,                \
+	[ADC_SLOT_CLIFF_LEFT]  = ADC_CH_CLIFF_LEFT,             \
+	[ADC_SLOT_CLIFF_FRONT] = ADC_CH_CLIFF_FRONT,            \
+	[ADC_SLOT_CLIFF_RIGHT] = ADC_CH_CLIFF_RIGHT,            \
+}
+
+/* ---------- Sharp IR linearisation -------------------- *
+ *   GP2Y0A41SK0F on AVcc = 5 V: d [mm] ~ SHARP_K / (raw -
+ *   SHARP_RAW_OFS), fitted to the datasheet curve; clamped to
+ *   the rated range. Refit with a few floor heights per robot. */
+#define SHARP_K               20760.0f  // mm*counts
+#define SHARP_RAW_OFS         11        // counts
+#define SHARP_MM_MIN          40        // mm - nearest rated distance
+#define SHARP_MM_MAX          300       // mm - farthest rated distance
+
+/* ---------- Cliff fast stop ---------------------------- *
+ *   The Sharp output drops when the floor falls away. The ADC
+ *   ISR brakes as soon as a cliff sensor goes from at or
+ *   within its distance to beyond it. 0 = channel not
+ *   watched; set per robot here or with the CLIFF service
+ *   command.                                               */
+#define CLIFF_MAX_MM_LEFT     0
+#define CLIFF_MAX_MM_FRONT    0
+#define CLIFF_MAX_MM_RIGHT    0
+#define CLIFF_STOP_ACC        2000.0f   // mm/s^2 - controlled-stop deceleration
+
 /* ---------- Conversion parameters --------------------- */
-#define ADC_NUM_SAMPLES     4   // simple software average
+#define ADC_AVG_SHIFT       2   // running average over ~2^n conversions per channel
+#define ADC_IDLE_HZ         2000UL  // conversions/s with the step clock stopped (all channels)
 #define ADC_PRESCALER_BITS  ((1<<ADPS2)|(1<<ADPS1)|(1<<ADPS0)) /* 128 */
+#define ADC_SH_DELAY_CYCLES 256U    // auto trigger -> sample-and-hold: 2 ADC clocks at 128
 
 /* ---------- Battery-scaling maths --------------------- *
- *   VBAT =  ADCraw * (AVcc / 1023) * (R1+R2) / R2
- *   Put the resistor ratios here so the driver can give
- *   you millivolts directly.  Example 100 k? / 33 k?.     */
-#define BAT_DIV_FACTOR_NUM  (1)   // (R1+R2)*100 / R2
-#define BAT_DIV_FACTOR_DEN  (1)
+ *   VBAT =  ADCraw * (AVcc / 1024) * (R1+R2) / R2
+ *   The reference is AVcc (REFS0). R1 is the divider's top
+ *   resistor (battery side), R2 the bottom one; set them to
+ *   the parts fitted. 100 k / 10 k reads up to 55 V.        */
+#define ADC_AVCC_MV         5000UL  // mV - AVcc, the ADC reference
+#define BAT_DIV_R1_OHM      100000UL
+#define BAT_DIV_R2_OHM      10000UL
+
+/* ---------- Battery filter ------------------------------ *
+ *   Once per loop tick, on top of the ISR average. A drop is
+ *   followed fast so derating catches a sag; a rise slowly,
+ *   so the limits do not pump as the load comes and goes.  */
+#define BAT_FALL_SHIFT      3       // time constant 2^n ticks (80 ms) when falling
+#define BAT_RISE_SHIFT      7       // time constant 2^n ticks (1.3 s) when rising
 
 
 
@@ -209,6 +371,7 @@
 #define ENCODER_PPR         1000U        // quadrature pulses per channel
 #define WHEEL_DIAMETER_MM   200.0f        // wheel diameter [mm]
 #define WHEEL_BASE_MM       500.0f       // track width: distance between wheels [mm] 
+#define WHEEL_AXLE_BASE_MM  400.0f       // front-rear axle distance [mm] (mecanum only)
 #define GEAR_RATIO 10   
 
 #define MM_PER_ROTATION  (M_PI * WHEEL_DIAMETER_MM)
@@ -216,6 +379,43 @@
 
 #define LOOP_TIME 10
 
+// Segment batches (lookahead planner)
+#define PLANNER_MAX_SEGMENTS 8         // segments held per uploaded batch
+
+// Final-approach settling (only for segments that end at zero speed)
+#define SETTLE_ENABLED       1         // 0 = finish as soon as the braking ramp ends
+#define SETTLE_TOL_MM        1.0f      // mm    - accepted encoder position error
+#define SETTLE_TOL_DEG       0.2f      // deg   - accepted encoder heading error
+#define SETTLE_CREEP_MM_S    20.0f     // mm/s  - creep speed limit
+#define SETTLE_CREEP_DPS     4.0f      // deg/s - creep rate limit
+#define SETTLE_STILL_MM_S    2.0f      // mm/s  - wheels considered stopped below this
+#define SETTLE_STILL_DPS     0.5f      // deg/s - robot considered stopped below this
+#define SETTLE_GAIN          4.0f      // 1/s   - creep speed per unit of error
+#define SETTLE_HOLD_TICKS    5         // consecutive loop ticks in band to accept
+#define SETTLE_TIMEOUT_S     2.0f      // s     - give up and finish anyway
+
+// Following error: emitted steps vs encoder counts (stall / lost steps)
+#define FOLLOW_ENABLED       1         // 0 = report the error only, never stop
+#define FOLLOW_MAX_ERR_MM    5.0f      // mm     - per-wheel trip threshold
+#define FOLLOW_TRIP_TICKS    3         // consecutive loop ticks above threshold
+#define FOLLOW_STOP_ACC      1500.0f   // mm/s^2 - controlled-stop deceleration
+
+// Hot-path probes (prof.h), dumped by the PROF service command
+#ifndef PROF_ENABLED                   // (the host benches build without them)
+#define PROF_ENABLED         1         // 0 = PROF_BEGIN/PROF_END compile to nothing
+#endif
+
+// Event trace (trace.h), dumped by the TRACE service command
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED        1         // 0 = TRACE_MARK/TRACE_SPAN compile to nothing
+#endif
+#define TRACE_LEN            48        // events per capture, 6 bytes each
+
+// Interrupts-off watermarks (irqmon.h), dumped by the IRQ service command
+#ifndef IRQMON_ENABLED
+#define IRQMON_ENABLED       1         // 0 = irqmon_begin/irqmon_end compile to nothing
+#endif
+
 // Teleoperator Mode - Distance and Angles
 #define FORWARD_DIST         400.0f    // mm - Forward movement per command
 #define BACKWARD_DIST        400.0f    // mm - Backward movement per command
@@ -230,4 +430,23 @@
 #define TELEOP_ACC           200.0f    // mm/s - Linear acceleration
 #define TELEOP_ALPHA         30.0f    // deg/s - Angular acceleration
 
+/* ================= SLOPE / TILT DERATING ================= */
+// Acceleration and top speed shrink with the tilt reported by the BNO055 so the
+// same command limits are safe on ramps.  Scale is 1.0 up to TILT_DEADBAND_DEG,
+// then falls with sin(tilt) down to the minimum at TILT_LIMIT_DEG.
+#define TILT_DEADBAND_DEG     2.0f      // deg - mounting offset / vibration
+#define TILT_LIMIT_DEG        15.0f     // deg - slope where the minimum scale is reached
+#define TILT_MIN_ACC_SCALE    0.25f     // fraction of the commanded acceleration
+#define TILT_MIN_SPEED_SCALE  0.50f     // fraction of the commanded top speed
+
+/* ================= BATTERY DERATING ================= */
+// A sagging pack leaves the steppers less torque, worst at speed.  Scale is 1.0
+// down to BAT_DERATE_START_MV on the filtered main battery, linear down to the
+// minimum at BAT_DERATE_END_MV.  Combined with the tilt scale by taking the lower.
+#define BAT_DERATE_START_MV   24000     // mV - full performance at or above
+#define BAT_DERATE_END_MV     21000     // mV - minimum scale at or below
+#define BAT_ABSENT_MV         5000      // mV - below this no pack is measured: no derating
+#define BAT_MIN_ACC_SCALE     0.40f     // fraction of the commanded acceleration
+#define BAT_MIN_SPEED_SCALE   0.60f     // fraction of the commanded top speed
+
 #endif // CONFIG_H
\ No newline at end of file
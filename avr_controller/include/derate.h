@@ -0,0 +1,23 @@
+/*
+ * derate.h
+ *
+ * Motion-limit derating from measured operating conditions.
+ *  Author: Endeavor360
+ */
+
+#ifndef DERATE_H_
+#define DERATE_H_
+
+#include <stdint.h>
+
+/* feed the latest BNO055 Euler angles (deg*16, as from bno055_get_euler) */
+void  derate_update_tilt(int16_t roll16, int16_t pitch16);
+
+/* feed the filtered main battery voltage (analog_get_battery_1_mV) */
+void  derate_update_battery(uint16_t mv);
+
+/* multipliers for the profile limits, 0 < scale <= 1; the lower of tilt and battery */
+float derate_acc_scale(void);
+float derate_speed_scale(void);
+
+#endif /* DERATE_H_ */
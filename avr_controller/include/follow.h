@@ -0,0 +1,28 @@
+/*
+ * follow.h
+ *
+ * Following-error monitor: emitted steps vs encoder counts per wheel.
+ *  Author: Endeavor360
+ */
+
+#ifndef FOLLOW_H_
+#define FOLLOW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FOLLOW_LEFT   0x01
+#define FOLLOW_RIGHT  0x02
+
+/* once per loop tick; true only on the tick the monitor trips */
+bool    follow_update(void);
+
+bool    follow_fault(void);
+uint8_t follow_fault_side(void);        /* FOLLOW_LEFT | FOLLOW_RIGHT */
+void    follow_clear(void);             /* re-arm, step counters re-aligned to the encoders */
+
+/* encoder position minus step position [mm], + = wheel ahead of the steps */
+float   follow_error_left_mm(void);
+float   follow_error_right_mm(void);
+
+#endif /* FOLLOW_H_ */
@@ -0,0 +1,64 @@
+/*
+ * irqmon.h
+ *
+ * Longest stretch with interrupts globally off, per call site. An encoder
+ * edge that arrives inside such a stretch waits until it ends, so the worst
+ * value over all sites bounds the encoder ISR latency.
+ *
+ *     intr_state = SREG;
+ *     cli();
+ *     t0 = irqmon_begin();
+ *     ...
+ *     irqmon_end(IRQ_USB_TX, t0);
+ *     SREG = intr_state;
+ *
+ * ISR bodies count too (the I bit is clear while they run). Times are
+ * Timer 3 ticks (0.5 us); sections must stay under 32.768 ms. Set
+ * IRQMON_ENABLED to 0 in config.h and both calls compile to nothing.
+ *  Author: Endeavor360
+ */
+
+#ifndef IRQMON_H_
+#define IRQMON_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "config.h"
+
+typedef enum
+{
+	IRQ_USB_TX,      /* m_usb_tx_char(), putchar_nowait(), tx_push()   */
+	IRQ_USB_RX,      /* m_usb_rx_char(), rx_available(), rx_flush()    */
+	IRQ_USB_WRITE,   /* usb_serial_write(), per chunk                  */
+	IRQ_USB_ISR,     /* USB_GEN / USB_COM ISRs (enumeration is long)   */
+	IRQ_TIME,        /* micros32() / micros64()                        */
+	IRQ_ENC_GET,     /* encoder_get_left() / encoder_get_right()       */
+	IRQ_STEP_CMD,    /* motors_update() / motors_brake() hand-over     */
+	IRQ_STEP_ISR,    /* TIMER1_COMPA step ISR                          */
+	IRQ_ADC_ISR,     /* ADC scan / cliff watch ISR                     */
+	IRQ_SITE_COUNT
+} IrqSite;
+
+extern volatile uint16_t irqmon_max[IRQ_SITE_COUNT]; /* ticks */
+
+#if IRQMON_ENABLED
+/* interrupts are off at both calls, so TCNT3 reads cleanly */
+static inline uint16_t irqmon_begin(void) { return TCNT3; }
+
+static inline void irqmon_end(uint8_t site, uint16_t t0)
+{
+	uint16_t d = TCNT3 - t0;
+	if (d > irqmon_max[site])
+		irqmon_max[site] = d;
+}
+#else
+static inline uint16_t irqmon_begin(void) { return 0; }
+static inline void irqmon_end(uint8_t site, uint16_t t0) { (void)site; (void)t0; }
+#endif
+
+/* "IRQ <site> max=<us>" for one site; reset = clear it after the copy */
+int irqmon_format(uint8_t site, char *buf, size_t n, bool reset);
+
+#endif /* IRQMON_H_ */
@@ -13,6 +13,7 @@
 
 void motors_init(void);
 void motors_update( float velocity, float omega);
+void motors_update_holonomic(float vx, float vy, float omega); /* vy + = left, mecanum only */
 void motors_enable_left(bool en);
 void motors_enable_right(bool en);
 void motors_enable_all(bool en);
@@ -22,5 +23,15 @@ void motors_set_speed_left(uint16_t rpm);
 void motors_set_speed_right(uint16_t rpm);
 void motors_set_speed_both(uint16_t rpm_left, uint16_t rpm_right);
 void motors_stop_all();
+void motors_brake(float acc);                  /* ramped stop, drivers stay enabled */
+void motors_set_fast_stop(float acc);          /* deceleration of motors_brake_from_isr() */
+void motors_brake_from_isr(void);              /* interrupts off: ramped stop, no maths   */
+
+/* steps emitted since the last reset, + = wheel forward; axis as in STEP_AXES */
+int32_t motors_get_steps(uint8_t axis);
+int32_t motors_get_steps_left(void);
+int32_t motors_get_steps_right(void);
+void    motors_set_steps(int32_t left, int32_t right);
+void    motors_reset_steps(void);
 
 #endif // MOTORS_H
\ No newline at end of file
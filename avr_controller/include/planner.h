@@ -0,0 +1,34 @@
+/*
+ * planner.h
+ *
+ * Batched motion segments with lookahead junction speeds.
+ *  Author: Endeavor360
+ */
+
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	float    distance;   /* mm, signed  (0 = pure turn)     */
+	float    angle;      /* deg, signed (0 = straight)      */
+	uint16_t max_vel;    /* mm/s  */
+	uint16_t max_omega;  /* deg/s */
+	float    lin_acc;    /* mm/s^2  */
+	float    ang_acc;    /* deg/s^2 */
+	float    exit_vel;   /* mm/s, junction speed into the next segment (planned) */
+} Segment;
+
+void    planner_clear(void);
+bool    planner_add(const Segment *s);   /* false when the batch is full        */
+uint8_t planner_count(void);
+const Segment *planner_segment(uint8_t i);
+
+float   planner_plan(void);              /* junction speeds, returns predicted s */
+bool    planner_start(void);             /* starts segment 0 (after planner_plan) */
+bool    planner_next(void);              /* call on PE_MOTION_COMPLETE           */
+bool    planner_active(void);
+
+#endif /* PLANNER_H_ */
@@ -0,0 +1,86 @@
+/*
+ * prof.h
+ *
+ * Hot-path probes: execution time per probe from the free-running Timer 3
+ * (0.5 us ticks), kept as count / min / max / sum in a static table.
+ *
+ *     PROF_BEGIN(PROF_MOTION);
+ *     ...
+ *     PROF_END(PROF_MOTION);
+ *
+ * Spans must stay under 32.768 ms (one TCNT3 wrap). Set PROF_ENABLED to 0
+ * in config.h and the macros compile to nothing. With TRACE_ENABLED each
+ * span also goes to the trace capture (trace.h).
+ *  Author: Endeavor360
+ */
+
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "config.h"
+#include "trace.h"
+
+typedef enum
+{
+	PROF_ENC_L,      /* INT2 / INT3 left encoder ISRs         */
+	PROF_ENC_R,      /* INT6 / PCINT0 right encoder ISRs      */
+	PROF_MOTION,     /* motion_update()                       */
+	PROF_MOTORS,     /* motors_update_holonomic()             */
+	PROF_IMU,        /* one bno055_get_*() read               */
+	PROF_ADC,        /* ADC conversion-complete ISR           */
+	PROF_TELEMETRY,  /* send_telemetry()                      */
+	PROF_COUNT
+} ProfId;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t sum;    /* ticks */
+	uint16_t min;    /* ticks, 0xFFFF = no sample yet */
+	uint16_t max;    /* ticks */
+} ProfStat;
+
+extern ProfStat prof_stats[PROF_COUNT];
+
+/* TCNT3 goes through the shared TEMP byte, so a main-loop read must not
+   be split by an ISR that reads it too */
+static inline uint16_t prof_now(void)
+{
+	uint8_t s = SREG; cli();
+	uint16_t t = TCNT3;
+	SREG = s;
+	return t;
+}
+
+/* each probe is written from one context only (one ISR group or main) */
+static inline void prof_record(uint8_t id, uint16_t ticks)
+{
+	ProfStat *p = &prof_stats[id];
+	p->count++;
+	p->sum += ticks;
+	if (ticks < p->min) p->min = ticks;
+	if (ticks > p->max) p->max = ticks;
+}
+
+#if PROF_ENABLED
+#define PROF_BEGIN(id)  uint16_t prof_t0_##id = prof_now()
+#define PROF_END(id)    do { uint16_t prof_t1 = prof_now();                        \
+                             prof_record((id), (uint16_t)(prof_t1 - prof_t0_##id)); \
+                             TRACE_SPAN((id), prof_t1, (uint16_t)(prof_t1 - prof_t0_##id)); \
+                        } while (0)
+#else
+#define PROF_BEGIN(id)  ((void)0)
+#define PROF_END(id)    ((void)0)
+#endif
+
+/* "PROF <name> n=<count> min=<us> avg=<us> max=<us>" for one probe;
+   reset = clear it after the copy. Returns the length written. */
+int  prof_format(uint8_t id, char *buf, size_t n, bool reset);
+const char *prof_name(uint8_t id);
+
+#endif /* PROF_H_ */
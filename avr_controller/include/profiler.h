@@ -16,7 +16,9 @@
 typedef enum {
 	PS_IDLE = 0,
 	PS_ACCELERATING,
+	PS_CRUISING,
 	PS_BRAKING,
+	PS_SETTLING,          /* creeping onto the encoder-measured target */
 	PS_FINISHED,
 } ProfileState;
 
@@ -25,6 +27,17 @@ typedef enum {
 	PK_ROTATION = 1,
 } ProfileKind;
 
+/* Result of the feasibility analysis done by profile_start() */
+typedef struct {
+	bool  feasible;       /* final speed reachable within the distance */
+	bool  triangular;     /* top speed is never reached                */
+	float peak_speed;     /* mm/s or deg/s, magnitude                  */
+	float accel_time;     /* s */
+	float cruise_time;    /* s */
+	float brake_time;     /* s */
+	float total_time;     /* s, predicted completion time              */
+} ProfilePlan;
+
 typedef struct {
 	volatile ProfileState state;
 	volatile float        speed;          /* mm/s or deg/s */
@@ -39,8 +52,30 @@ typedef struct {
 	float target_speed;
 	float final_speed;
 	float final_position;
+
+	ProfilePlan   plan;          /* filled in by profile_start()         */
+
+	float         settle_error;  /* target - encoder position at finish  */
+	float         settle_time;   /* s spent in PS_SETTLING               */
+	uint8_t       settle_hold;   /* ticks spent inside the tolerance     */
+
+	ProfileState  last_state;    /* state seen by the last event dispatch */
+	bool          watch_armed;   /* position threshold pending            */
+	float         watch_position;
 } Profile;
 
+/* ====================  Profile events =================== */
+
+typedef enum {
+	PE_PHASE_CHANGE = 0,  /* accel -> cruise -> brake transitions        */
+	PE_POSITION_REACHED,  /* armed threshold crossed (see motion_notify) */
+	PE_FINISHED,          /* profile entered PS_FINISHED                 */
+	PE_MOTION_COMPLETE,   /* every started profile has finished, p=NULL  */
+} ProfileEvent;
+
+/* Called from motion_update(); must not block. */
+typedef void (*ProfileEventHandler)(ProfileEvent ev, const Profile *p);
+
 /* Forward declaration of Motion aggregate */
 typedef struct {
 	Profile forward;
@@ -55,9 +90,14 @@ void profile_update(Profile *p);
 
 void profile_soft_reset(Profile *p); //only resets distance
 
+/* closed-form phase timing; speeds are magnitudes, v0 = speed at start */
+void profile_plan(ProfilePlan *pl, float distance, float v0, float top_s, float final_s, float acc);
+
 /* ====================  Motion facade =================== */
 void  motion_reset_drive_system(void);
+void  motion_begin_segment(void);             /* drivers stay enabled */
 void  motion_stop(void);
+void  motion_abort(void);
 float motion_position(void);
 float motion_velocity(void);
 float motion_acceleration(void);
@@ -69,9 +109,15 @@ void  motion_start_move(float dist, float top_v, float final_v, float acc);
 bool  motion_move_finished(void);
 void  motion_start_turn(float dist, float top_w, float final_w, float acc);
 bool  motion_turn_finished(void);
+const ProfilePlan *motion_move_plan(void);
+const ProfilePlan *motion_turn_plan(void);
 void  motion_update(void);
-void  motion_wait_until_position(float pos_mm);
-void  motion_wait_until_distance(float dist_mm);
+
+void  motion_set_settling(bool enable);          /* applies to the next finish */
+void  motion_set_limit_scale(float acc_scale, float speed_scale); /* derating, 1 = as commanded */
+void  motion_set_event_handler(ProfileEventHandler handler);
+void  motion_notify_at_position(float pos_mm);   /* one-shot PE_POSITION_REACHED */
+void  motion_notify_after_distance(float dist_mm);
 
 void motion_SOFT_reset_drive_system(void);
 
@@ -0,0 +1,44 @@
+/*
+ * recip.h
+ *
+ * Division-free quotients from a compile-time reciprocal table.
+ *  Author: Endeavor360
+ */
+
+#ifndef RECIP_H_
+#define RECIP_H_
+
+#include <stdint.h>
+
+/* 1/den as a Q31 mantissa and the shift that puts it back in scale */
+typedef struct {
+	uint32_t y;
+	uint8_t  shift;
+} Recip;
+
+Recip recip(uint32_t den);                 /* den != 0 */
+
+/* (num << sh) / den for the den behind r; the result must fit 32 bits and
+   sh must not exceed r.shift. Relative error <= 3 ppm, +/-1 count.          */
+static inline uint32_t recip_mul(uint32_t num, Recip r, uint8_t sh)
+{
+	/* shift the two halves: a variable 64-bit shift is a slow libgcc loop */
+	uint64_t p  = (uint64_t)num * r.y;
+	uint32_t hi = (uint32_t)(p >> 32);
+	uint32_t lo = (uint32_t)p;
+	uint8_t  s  = r.shift - sh;
+
+	if (s >= 32)
+		return hi >> (s - 32);
+	return s ? (hi << (32 - s)) | (lo >> s) : lo;
+}
+
+static inline uint32_t recip_div(uint32_t num, uint32_t den, uint8_t sh)
+{
+	return recip_mul(num, recip(den), sh);
+}
+
+/* floor(sqrt(x)), shift-and-subtract */
+uint16_t isqrt32(uint32_t x);
+
+#endif /* RECIP_H_ */
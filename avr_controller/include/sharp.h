@@ -0,0 +1,20 @@
+/*
+ * sharp.h
+ *
+ * Sharp IR distance sensors: ADC counts to millimetres.
+ *  Author: Endeavor360
+ */
+
+#ifndef SHARP_H_
+#define SHARP_H_
+
+#include <stdint.h>
+
+/* distance for an averaged ADC reading, clamped to SHARP_MM_MIN..SHARP_MM_MAX */
+uint16_t sharp_mm(uint16_t raw);
+
+/* lowest reading that sharp_mm() maps to mm or nearer; mm strictly
+   inside SHARP_MM_MIN..SHARP_MM_MAX (a clamped end matches a range)  */
+uint16_t sharp_raw_at_mm(uint16_t mm);
+
+#endif /* SHARP_H_ */
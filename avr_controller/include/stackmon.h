@@ -0,0 +1,28 @@
+/*
+ * stackmon.h
+ *
+ * RAM budget: .data/.bss sizes from the linker and the stack high-water
+ * mark. The free RAM between .bss and the stack is painted at reset (before
+ * .data is copied); the deepest stack use is where the paint was overwritten.
+ * No heap is used, so the paint sits right after .bss.
+ *  Author: Endeavor360
+ */
+
+#ifndef STACKMON_H_
+#define STACKMON_H_
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint16_t data;       /* .data bytes (initialised, copied from flash)   */
+	uint16_t bss;        /* .bss bytes                                     */
+	uint16_t stack_max;  /* deepest stack use since reset                  */
+	uint16_t free_min;   /* painted bytes never touched: the real headroom */
+	uint16_t ram;        /* SRAM size                                      */
+} StackReport;
+
+/* scans the paint, ~2 KB worst case; call from the main loop only */
+void stackmon_report(StackReport *r);
+
+#endif /* STACKMON_H_ */
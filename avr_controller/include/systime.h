@@ -14,8 +14,15 @@
 /*  Call once at start-up */
 void     systime_init(void);
 
-/*  1-s resolution, monotonic.
- *  Rolls over after ~292 000 years at 16 MHz (2?? half-s)               */
+/*  1-us resolution, monotonic, from Timer 3.
+ *  micros32() wraps after ~71.6 min; use it for intervals in hot paths.
+ *  micros64() runs for ~4.5 years (2^32 overflows of 32.768 ms).          */
+uint32_t micros32(void);
 uint64_t micros64(void);
 
+/*  Timer 3 overflow count (TCNT3 holds the low 16 bits of the 0.5-us tick).
+ *  Read it with interrupts off; an overflow still pending in TIFR3 is not
+ *  counted yet.                                                           */
+extern volatile uint32_t systime_ovf32;
+
 #endif /* SYSTIME_H_ */
@@ -0,0 +1,102 @@
+/*
+ * trace.h
+ *
+ * One-shot event capture for timeline views. TRACE arms it; recording starts
+ * at the next loop tick and stops when TRACE_LEN events are stored, so the
+ * buffer holds what happened inside that tick (and the next ones, if room)
+ * instead of the last few encoder edges. The TRACE service command dumps it
+ * and re-arms; test_sketches/trace_to_chrome converts the dump to Chrome
+ * trace JSON.
+ *
+ * Spans come from the PROF probes (prof.h) when both are enabled; marks are
+ * single points with a small argument.
+ *  Author: Endeavor360
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "config.h"
+#include "systime.h"
+
+typedef enum
+{
+	TR_TICK,         /* 10 ms loop tick starts             arg: 0                */
+	TR_CMD_RX,       /* a command line was received        arg: its first char   */
+	TR_USB_TX,       /* a USB IN packet was released       arg: 0 push, 1 full   */
+	TR_MARK_COUNT,
+	TR_SPAN = 0x80   /* TR_SPAN + ProfId, val = duration [ticks]                  */
+} TraceId;
+
+typedef struct
+{
+	uint16_t t;      /* TCNT3 at the mark, or at the end of a span */
+	uint8_t  ovf;    /* low byte of the Timer 3 overflow count      */
+	uint8_t  id;     /* TraceId                                     */
+	uint16_t val;    /* mark: argument; span: duration [0.5 us]     */
+} TraceEvent;
+
+#define TRACE_IDLE   0
+#define TRACE_ARMED  1
+#define TRACE_RUN    2
+
+extern TraceEvent       trace_buf[TRACE_LEN];
+extern volatile uint8_t trace_len;
+extern volatile uint8_t trace_state;
+
+#if TRACE_ENABLED
+/* span = the event ended at TCNT3 t_end (already read), else it is now */
+static inline void trace_put(uint8_t id, uint16_t val, bool span, uint16_t t_end)
+{
+	uint8_t s = SREG; cli();
+
+	if (trace_state == TRACE_ARMED && id == TR_TICK)
+		trace_state = TRACE_RUN;
+
+	if (trace_state == TRACE_RUN)
+	{
+		uint16_t now = TCNT3;
+		uint8_t  ovf = (uint8_t)systime_ovf32;
+
+		if ((TIFR3 & _BV(TOV3)) && now < 0x8000U)
+			ovf++;
+		if (span)
+		{
+			if (now < t_end) /* wrapped since the span ended */
+				ovf--;
+			now = t_end;
+		}
+
+		TraceEvent *e = &trace_buf[trace_len];
+		e->t = now;
+		e->ovf = ovf;
+		e->id = id;
+		e->val = val;
+
+		if (++trace_len == TRACE_LEN)
+			trace_state = TRACE_IDLE;
+	}
+
+	SREG = s;
+}
+
+#define TRACE_MARK(id, arg)          trace_put((id), (arg), false, 0)
+#define TRACE_SPAN(pid, t_end, dur)  trace_put(TR_SPAN + (pid), (dur), true, (t_end))
+#else
+#define TRACE_MARK(id, arg)          ((void)0)
+#define TRACE_SPAN(pid, t_end, dur)  ((void)0)
+#endif
+
+/* freeze the capture for dumping; returns the number of events held */
+uint8_t trace_stop(void);
+/* "TRACE <ticks> X|I <name> <val>" for event i (ticks: 24-bit, 0.5 us) */
+int     trace_format(uint8_t i, char *buf, size_t n);
+/* drop the capture, record again from the next loop tick */
+void    trace_arm(void);
+
+#endif /* TRACE_H_ */
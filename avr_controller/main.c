@@ -8,6 +8,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <stdio.h>
+#include <string.h>
 #include <util/delay.h>
 #include <stdbool.h>
 #include <math.h>
@@ -16,9 +17,17 @@
 #include "m_usb.h"
 #include "bno055_ll.h"
 #include "analog.h"
+#include "sharp.h"
 #include "encoder.h"
 #include "profiler.h"
+#include "planner.h"
+#include "derate.h"
+#include "follow.h"
 #include "systime.h"
+#include "prof.h"
+#include "trace.h"
+#include "irqmon.h"
+#include "stackmon.h"
 
 #define RX_BUF_SIZE 64
 
@@ -73,10 +82,16 @@ static void timer4_init(void);                            /* sets up periodic IR
 static void send_telemetry(bool emerg, bool profileDone); /* heavy USB / sensor work         */
 static void usb_send_ram(const char *s);
 static uint8_t parse_jetson(const char *line);
+static void parse_service(const char *line);
 static void receive_from_jetson(void);
 
 static void send_debug(void);
 static void send_cmd_echo(void);
+static void send_cmd_ack(void);
+static void send_cmd_done(void);
+static void send_follow_fault(void);
+static void send_cliff_fault(const CliffEvent *e);
+static void on_motion_event(ProfileEvent ev, const Profile *p);
 
 /*  ------------------------------ GLOBAL FLAG ------------------------*/
 static volatile uint8_t loop_execute = 0; /* set in ISR, cleared in main */
@@ -84,15 +99,13 @@ static volatile uint8_t loop_execute = 0; /* set in ISR, cleared in main */
 bool emerg = false;
 bool profile_done = true;
 
-typedef enum
-{
-    NONE = 0,
-    FORWARD = 1,
-    ROTATION = 2,
-    BOTH = 3,
-} MoveType;
+/* orientation, read once per tick: used for derating and telemetry (deg*16) */
+static int16_t imu_h16, imu_r16, imu_p16;
 
-MoveType determineFinishnes = NONE;
+/* latched by on_motion_event() during motion_update(), cleared only where the
+   autonomous/teleop branch consumes it (or the job is dropped): the event fires
+   once, so a tick held off by the emergency button must not lose it */
+static bool motion_complete = false;
 
 /* ====================================================*/
 int main(void)
@@ -116,11 +129,12 @@ int main(void)
         m_usb_tx_string("IMU Failed\r\n");
     }
 
-    /* ---- start 125 Hz timer & enable global IRQs ---- */
-    timer4_init(); /* Timer-3 compare-match every 8 ms        */
+    /* ---- start 100 Hz timer & enable global IRQs ---- */
+    timer4_init(); /* Timer-4 compare-match every 10 ms       */
     sei();         /* global interrupt enable                 */
 
     /* ---------------- MAIN LOOP ---------------------- */
+    motion_set_event_handler(on_motion_event);
     motion_reset_drive_system(); // initialize the encoder counts, velocities, omegas, distances, angles to 0
     while (1)
     {
@@ -130,35 +144,58 @@ int main(void)
         if (loop_execute)
         {
             loop_execute = 0;
+            TRACE_MARK(TR_TICK, 0);
 
             receive_from_jetson();
             encoder_odometry_update();
-            motion_update();
+
+            /* slope- and battery-aware limits for this tick */
+            bno055_get_euler(&imu_h16, &imu_r16, &imu_p16);
+            derate_update_tilt(imu_r16, imu_p16);
+            analog_update();
+            derate_update_battery(analog_get_battery_1_mV());
+            motion_set_limit_scale(derate_acc_scale(), derate_speed_scale());
+
+            motion_update(); /* dispatches profile events, never blocks */
+
+            if (follow_update()) /* stall or lost steps: ramp down, drop the job */
+            {
+                motion_abort();
+                planner_clear();
+                motion_complete = false;
+                motors_brake(FOLLOW_STOP_ACC);
+                teleStates = NONETELEOP;
+                profile_done = true;
+                send_follow_fault();
+            }
+
+            CliffEvent cliff;
+            if (analog_cliff_take(&cliff)) /* the ADC ISR already braked: drop the job */
+            {
+                motion_abort();
+                planner_clear();
+                motion_complete = false;
+                motors_brake(CLIFF_STOP_ACC); /* takes over the ISR brake, ramp from the actual speed */
+                teleStates = NONETELEOP;
+                profile_done = true;
+                send_cliff_fault(&cliff);
+            }
 
             // bool imu_ok = bno055_read8(0x00, &id) && (id == 0xA0);
             // if (imu_ok) bno055_gpio_reset();
 
-            if (!emerg)
+            if (!emerg && !follow_fault() && !analog_cliff_fault())
             {
                 if (control_mode == AUTONOMOUS)
                 {
-                    if (determineFinishnes == BOTH && motion_turn_finished() && motion_move_finished())
-                    {
-                        profile_done = true;
-                        motion_reset_drive_system();
-                        determineFinishnes = NONE;
-                    }
-                    else if (determineFinishnes == FORWARD && motion_move_finished())
-                    {
-                        profile_done = true;
-                        motion_reset_drive_system();
-                        determineFinishnes = NONE;
-                    }
-                    else if (determineFinishnes == ROTATION && motion_turn_finished())
+                    bool done = motion_complete;
+                    motion_complete = false;
+
+                    if (done && !planner_next()) /* batches chain without stopping */
                     {
                         profile_done = true;
-                        motion_reset_drive_system();
-                        determineFinishnes = NONE;
+                        send_cmd_done();
+                        motion_begin_segment();
                     }
                     else
                     {
@@ -167,8 +204,9 @@ int main(void)
                 }
                 else if (control_mode == TELEOPERATOR)
                 {
-                    if ((determineFinishnes == FORWARD && motion_move_finished()) ||  (determineFinishnes == ROTATION && motion_turn_finished()))
+                    if (motion_complete)
                     {
+                        motion_complete = false;
                         profile_done = true;
 
                         if (teleStates == ACCELERATING)
@@ -178,7 +216,7 @@ int main(void)
                         else if (teleStates == DECELERATING)
                         {
                             teleStates = NONETELEOP;
-							motion_reset_drive_system();
+							motion_begin_segment();
                         }
                     }
 
@@ -188,9 +226,9 @@ int main(void)
                     }
                 }
             }
-            else
+            else if (emerg)
             {
-                motors_stop_all();
+                motion_stop();
             }
 
             if (debug_mode == MOTION_DEBUG || debug_mode == MD_AND_ECHO)
@@ -230,14 +268,23 @@ ISR(TIMER4_COMPA_vect)
     loop_execute = 1; /* signal main loop           */
 }
 
+/* ------------------- MOTION EVENTS (called from motion_update) ----------- */
+static void on_motion_event(ProfileEvent ev, const Profile *p)
+{
+    (void)p;
+
+    if (ev == PE_MOTION_COMPLETE)
+        motion_complete = true;
+}
+
 /* ------------------- TELEMETRY SENDER (called from main) ----------------- */
 static void send_telemetry(bool emerg, bool profileDone)
 {
+    PROF_BEGIN(PROF_TELEMETRY);
     char line[180];
 
-    /* --- orientation --- */
-    int16_t h16, r16, p16;
-    bno055_get_euler(&h16, &r16, &p16);
+    /* --- orientation (sampled at the start of the tick) --- */
+    const int16_t h16 = imu_h16, r16 = imu_r16, p16 = imu_p16;
 
     /* --- angular rate --- */
     int16_t gx16, gy16, gz16;
@@ -264,21 +311,26 @@ static void send_telemetry(bool emerg, bool profileDone)
     /* ---------- ADC ---------- */
     uint16_t vbat_1 = analog_get_battery_1_mV();
     uint16_t vbat_2 = analog_get_battery_2_mV();
-    uint16_t cliffL = analog_get_cliff_left();
-    uint16_t cliffC = analog_get_cliff_front();
-    uint16_t cliffR = analog_get_cliff_right();
+    uint16_t cliffL = analog_get_cliff_left_mm();
+    uint16_t cliffC = analog_get_cliff_front_mm();
+    uint16_t cliffR = analog_get_cliff_right_mm();
 
     /* ---------- Encoders ---------- */
     int32_t encL = encoder_get_left();
     int32_t encR = encoder_get_right();
 
+    /* ---------- Following error ---------- */
+    const float ferrL = follow_error_left_mm();
+    const float ferrR = follow_error_right_mm();
+
     /* ---------- Format & ship ---------- */
-    /* Packet Structure: { Yaw Roll Pitch IMUOmega accrX accrY encoderLeft encoderRight bat1Voltage bat2Voltage LeftCliff CenterCliff RightCliff emergencyFlag }  */
+    /* Packet Structure: { Yaw Roll Pitch IMUOmega accrX accrY encoderLeft encoderRight bat1Voltage bat2Voltage LeftCliffMm CenterCliffMm RightCliffMm emergencyFlag profileDone followErrLeft followErrRight followFault }  */
     snprintf(line, sizeof(line),
-             "%3.2f %3.2f %3.2f %+3.2f %+3.2f %+3.2f %+3.2f %+3.2f %+3.2f %10ld %10ld %u %u %u %u %u %u %u\r\n", h, r, p, wx, wy, wz, ax, ay, az, (long)encL, (long)encR, vbat_1, vbat_2, cliffL, cliffC, cliffR, emerg, profileDone);
+             "%3.2f %3.2f %3.2f %+3.2f %+3.2f %+3.2f %+3.2f %+3.2f %+3.2f %10ld %10ld %u %u %u %u %u %u %u %+.1f %+.1f %u\r\n", h, r, p, wx, wy, wz, ax, ay, az, (long)encL, (long)encR, vbat_1, vbat_2, cliffL, cliffC, cliffR, emerg, profileDone, ferrL, ferrR, follow_fault_side());
 
     usb_send_ram(line);
     m_usb_tx_push();
+    PROF_END(PROF_TELEMETRY);
 }
 
 // SpdL:%+6.1f SpdR: %+6.1f Vel: %+6.1f Omg: %+5.1f dist: %+8.1f ang: %+7.1f dt: %7.1f
@@ -324,6 +376,65 @@ static void send_cmd_echo(void)
     m_usb_tx_push();
 }
 
+/* Predicted execution of the command just accepted, so the host can
+   schedule ahead instead of polling profile_done.
+   Format:  “ACK T=2.400 F 1 0 300.0 0.600 1.200 0.600 R 1 1 40.0 0.400 0.000 0.400”
+            T = predicted completion [s], then per profile:
+            feasible triangular peak_speed t_accel t_cruise t_brake            */
+static void send_cmd_ack(void)
+{
+    const ProfilePlan *fp = motion_move_plan();
+    const ProfilePlan *rp = motion_turn_plan();
+
+    char buf[150];
+    snprintf(buf, sizeof(buf),
+             "ACK T=%.3f F %u %u %.1f %.3f %.3f %.3f R %u %u %.1f %.3f %.3f %.3f\r\n",
+             fmaxf(fp->total_time, rp->total_time),
+             fp->feasible, fp->triangular, fp->peak_speed, fp->accel_time, fp->cruise_time, fp->brake_time,
+             rp->feasible, rp->triangular, rp->peak_speed, rp->accel_time, rp->cruise_time, rp->brake_time);
+
+    usb_send_ram(buf);
+    m_usb_tx_push();
+}
+
+/* Endpoint accuracy of the command that just completed.
+   Format:  "DONE F -0.42 0.310 R 0.05 0.120"
+            per profile: encoder-measured error at finish [mm|deg], time spent settling [s] */
+static void send_cmd_done(void)
+{
+    extern MotionType motionType;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "DONE F %.2f %.3f R %.2f %.3f\r\n",
+             motionType.forward.settle_error, motionType.forward.settle_time,
+             motionType.rotation.settle_error, motionType.rotation.settle_time);
+
+    usb_send_ram(buf);
+    m_usb_tx_push();
+}
+
+/* Following-error trip; sent once, the robot is already ramping down.
+   Format:  "FAULT FOLLOW 1 L -6.3 R 0.2"   side mask (1 = left, 2 = right), error per wheel [mm] */
+static void send_follow_fault(void)
+{
+    char buf[48];
+    snprintf(buf, sizeof(buf), "FAULT FOLLOW %u L %.1f R %.1f\r\n",
+             follow_fault_side(), follow_error_left_mm(), follow_error_right_mm());
+
+    usb_send_ram(buf);
+    m_usb_tx_push();
+}
+
+static void send_cliff_fault(const CliffEvent *e)
+{
+    char buf[48];
+    snprintf(buf, sizeof(buf), "FAULT CLIFF %u T %lu MM %u RAW %u\r\n",
+             e->side, (unsigned long)e->t_us, sharp_mm(e->raw), e->raw);
+
+    usb_send_ram(buf);
+    m_usb_tx_push();
+}
+
 /* ------------------- Tiny helper ------------------------- */
 static void usb_send_ram(const char *s)
 {
@@ -373,6 +484,124 @@ static uint8_t parse_jetson(const char *line)
     return cnt;
 }
 
+/* Service commands: upper-case keyword, then comma separated arguments.
+     SEG,d,a,vmax,wmax,acc,aacc   append a segment to the batch  -> "SEG <count> OK|ERR"
+     RUN                          plan junction speeds and run it -> "ACK T=<s> N=<n> J <v0> <v1> ..."
+                                  ("RUN BUSY" while a batch runs; the batch is dropped when it completes;
+                                   "RUN EMPTY" with no segments queued, nothing changes)
+     CLR                          drop the batch                  -> "CLR"
+     PROF                         dump the probe table, clear it  -> "PROF <name> n=<count> min= avg= max= us" ... "PROF END"
+     TRACE                        dump the capture, re-arm it     -> "TRACE <ticks> X|I <name> <val>" ... "TRACE END <n>"
+     IRQ                          interrupts-off watermarks, clear -> "IRQ <site> max=<us> us" ... "IRQ END"
+     STACK                        RAM budget [bytes]              -> "STACK data= bss= stack_max= free_min= ram="
+     CLIFF[,l,f,r]                set / show cliff distances [mm] -> "CLIFF <l> <f> <r>" (0 = not watched) */
+static void parse_service(const char *line)
+{
+    char buf[100];
+
+    if (strncmp(line, "SEG,", 4) == 0)
+    {
+        Segment s = {0};
+        unsigned int vmax, wmax;
+        bool ok = false;
+
+        if (sscanf(line + 4, "%f,%f,%u,%u,%f,%f",
+                   &s.distance, &s.angle, &vmax, &wmax, &s.lin_acc, &s.ang_acc) == 6)
+        {
+            s.max_vel = vmax;
+            s.max_omega = wmax;
+            ok = planner_add(&s);
+        }
+
+        snprintf(buf, sizeof(buf), "SEG %u %s\r\n", planner_count(), ok ? "OK" : "ERR");
+    }
+    else if (strcmp(line, "RUN") == 0 && planner_active())
+    {
+        snprintf(buf, sizeof(buf), "RUN BUSY\r\n"); /* no restart mid-batch */
+    }
+    else if (strcmp(line, "RUN") == 0 && planner_count() == 0)
+    {
+        snprintf(buf, sizeof(buf), "RUN EMPTY\r\n"); /* leaves mode, faults and motion alone */
+    }
+    else if (strcmp(line, "RUN") == 0)
+    {
+        float total = planner_plan();
+
+        control_mode = AUTONOMOUS;
+        motion_set_settling(SETTLE_ENABLED);
+        motion_begin_segment();
+        follow_clear();
+        analog_cliff_clear();
+        motion_complete = false;
+        planner_start();
+        profile_done = false;
+
+        int n = snprintf(buf, sizeof(buf), "ACK T=%.3f N=%u J", total, planner_count());
+        for (uint8_t i = 0; i < planner_count() && n < (int)sizeof(buf) - 10; i++)
+            n += snprintf(buf + n, sizeof(buf) - n, " %.0f", planner_segment(i)->exit_vel);
+        snprintf(buf + n, sizeof(buf) - n, "\r\n");
+    }
+    else if (strcmp(line, "CLR") == 0)
+    {
+        planner_clear();
+        snprintf(buf, sizeof(buf), "CLR\r\n");
+    }
+    else if (strcmp(line, "PROF") == 0)
+    {
+        for (uint8_t i = 0; i < PROF_COUNT; i++)
+        {
+            prof_format(i, buf, sizeof(buf), true);
+            usb_send_ram(buf);
+        }
+        snprintf(buf, sizeof(buf), "PROF END\r\n");
+    }
+    else if (strcmp(line, "TRACE") == 0)
+    {
+        uint8_t n = trace_stop();
+        for (uint8_t i = 0; i < n; i++)
+        {
+            trace_format(i, buf, sizeof(buf));
+            usb_send_ram(buf);
+        }
+        trace_arm();
+        snprintf(buf, sizeof(buf), "TRACE END %u\r\n", n);
+    }
+    else if (strcmp(line, "IRQ") == 0)
+    {
+        for (uint8_t i = 0; i < IRQ_SITE_COUNT; i++)
+        {
+            irqmon_format(i, buf, sizeof(buf), true);
+            usb_send_ram(buf);
+        }
+        snprintf(buf, sizeof(buf), "IRQ END\r\n");
+    }
+    else if (strcmp(line, "CLIFF") == 0 || strncmp(line, "CLIFF,", 6) == 0)
+    {
+        unsigned int tl, tf, tr;
+        if (line[5] == ',' && sscanf(line + 6, "%u,%u,%u", &tl, &tf, &tr) == 3)
+            analog_cliff_set(tl, tf, tr);
+
+        snprintf(buf, sizeof(buf), "CLIFF %u %u %u\r\n",
+                 analog_cliff_threshold(ADC_SLOT_CLIFF_LEFT),
+                 analog_cliff_threshold(ADC_SLOT_CLIFF_FRONT),
+                 analog_cliff_threshold(ADC_SLOT_CLIFF_RIGHT));
+    }
+    else if (strcmp(line, "STACK") == 0)
+    {
+        StackReport r;
+        stackmon_report(&r);
+        snprintf(buf, sizeof(buf), "STACK data=%u bss=%u stack_max=%u free_min=%u ram=%u\r\n",
+                 r.data, r.bss, r.stack_max, r.free_min, r.ram);
+    }
+    else
+    {
+        return;
+    }
+
+    usb_send_ram(buf);
+    m_usb_tx_push();
+}
+
 static void receive_from_jetson(void)
 {
     
@@ -385,41 +614,47 @@ static void receive_from_jetson(void)
             if (rx_index > 0)
             {
                 rx_buf[rx_index] = '\0';
-                if (parse_jetson(rx_buf))
+                TRACE_MARK(TR_CMD_RX, (uint8_t)rx_buf[0]);
+                if (rx_buf[0] >= 'A' && rx_buf[0] <= 'Z')
                 {
+                    parse_service(rx_buf);
+                }
+                else if (parse_jetson(rx_buf))
+                {
+                    planner_clear(); /* a direct command supersedes any batch */
+                    follow_clear();  /* ... and re-arms the following-error monitor */
+                    analog_cliff_clear(); /* ... and the cliff stop (edges still in view stay disarmed) */
+                    motion_complete = false; /* ... and a completion the old job left latched */
 
                     if (debug_mode == RX_ECHO || debug_mode == MD_AND_ECHO)
                     {
                         send_cmd_echo();
                     }
 
+                    /* creep onto docking targets in autonomous mode only; teleop stops are approximate */
+                    motion_set_settling(SETTLE_ENABLED && control_mode == AUTONOMOUS);
+
                     if (control_mode == AUTONOMOUS)
                     {
                         if (rx_distance != 0 && rx_angle != 0)
                         {
-                            determineFinishnes = BOTH;
-                            motion_reset_drive_system();
+                            motion_begin_segment();
                             motion_start_move(rx_distance, rx_max_vel, rx_last_vel, rx_lin_acc);
                             motion_start_turn(rx_angle, rx_max_omega, rx_last_omega, rx_ang_acc);
                         }
                         else if (rx_distance != 0)
                         {
-                            determineFinishnes = FORWARD;
-                            motion_reset_drive_system();
+                            motion_begin_segment();
                             motion_start_move(rx_distance, rx_max_vel, rx_last_vel, rx_lin_acc);
                         }
                         else if (rx_angle != 0)
                         {
-                            determineFinishnes = ROTATION;
-                            motion_reset_drive_system();
+                            motion_begin_segment();
                             motion_start_turn(rx_angle, rx_max_omega, rx_last_omega, rx_ang_acc);
                         }
-                        else
-                        {
-                            determineFinishnes = NONE;
-                        }
 
                         profile_done = false;
+                        send_cmd_ack();
                     }
                     else if (control_mode == TELEOPERATOR)
                     {
@@ -431,26 +666,22 @@ static void receive_from_jetson(void)
                         if (need_new_profile)
                         {
 							teleStates = ACCELERATING;
-                            motion_reset_drive_system();
+                            motion_begin_segment();
 							
                             if (f)
                             {
-                                determineFinishnes = FORWARD;
                                 motion_start_move(FORWARD_DIST, TELEOP_SPEED, TELEOP_SPEED, TELEOP_ACC);
                             }
                             else if (b)
                             {
-                                determineFinishnes = FORWARD;
                                 motion_start_move(-BACKWARD_DIST, TELEOP_SPEED, TELEOP_SPEED, TELEOP_ACC);
                             }
                             else if (l)
                             {
-                                determineFinishnes = ROTATION;
                                 motion_start_turn(LEFT_TURN_ANGLE, TELEOP_OMEGA, TELEOP_OMEGA, TELEOP_ALPHA);
                             }
                             else if (r)
                             {
-                                determineFinishnes = ROTATION;
                                 motion_start_turn(-RIGHT_TURN_ANGLE, TELEOP_OMEGA, TELEOP_OMEGA, TELEOP_ALPHA);
                             }
 
@@ -463,22 +694,18 @@ static void receive_from_jetson(void)
 
                             if (last_command & 0b1000)
                             {
-                                determineFinishnes = FORWARD;
                                 motion_start_move(FORWARD_DIST / 2, TELEOP_SPEED, 0, TELEOP_ACC);
                             }
                             else if (last_command & 0b0100)
                             {
-                                determineFinishnes = FORWARD;
                                 motion_start_move(-BACKWARD_DIST / 2, TELEOP_SPEED, 0, TELEOP_ACC);
                             }
                             else if (last_command & 0b0010)
                             {
-                                determineFinishnes = ROTATION;
                                 motion_start_turn(LEFT_TURN_ANGLE / 2, TELEOP_OMEGA, 0, TELEOP_ALPHA);
                             }
                             else if (last_command & 0b0001)
                             {
-                                determineFinishnes = ROTATION;
                                 motion_start_turn(-RIGHT_TURN_ANGLE / 2, TELEOP_OMEGA, 0, TELEOP_ALPHA);
                             }
 
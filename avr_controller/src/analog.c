@@ -7,6 +7,13 @@
 
 #include "analog.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "prof.h"
+#include "irqmon.h"
+#include "motors.h"
+#include "systime.h"
+#include "sharp.h"
 
 static inline void adc_select_channel(uint8_t ch)
 {
@@ -20,54 +27,282 @@ static inline void adc_select_channel(uint8_t ch)
 	}
 }
 
+static const uint8_t scan_ch[ADC_SLOT_COUNT] = ADC_SCAN;
+
+/* auto-trigger sources (ADTS3:0) */
+#define ADTS_MASK    ((1<<ADTS3)|(1<<ADTS2)|(1<<ADTS1)|(1<<ADTS0))
+#define ADTS_T0_CMPA ((1<<ADTS1)|(1<<ADTS0))   /* 0011 Timer-0 compare A */
+#define ADTS_T1_CMPB ((1<<ADTS2)|(1<<ADTS0))   /* 0101 Timer-1 compare B */
+
+/* Timer-0 CTC at /64 for the idle pace */
+#define ADC_IDLE_OCR0A  ((uint8_t)(F_CPU / 64UL / ADC_IDLE_HZ - 1))
+#if F_CPU / 64UL / ADC_IDLE_HZ - 1 > 255
+#error "ADC_IDLE_HZ too low for Timer-0 at /64"
+#endif
+
+/* Timer-1 is the step clock; running = a clock select is set */
+#define STEP_CLOCK_RUNNING()  (TCCR1B & ((1<<CS12)|(1<<CS11)|(1<<CS10)))
+
+/* running averages, Q(ADC_AVG_SHIFT); written by the ISR only */
+static volatile uint16_t avg_q[ADC_SLOT_COUNT];
+static uint8_t scan_slot;
+static uint8_t seeded; /* slot bits: first sample taken */
+
+/* cliff watch, per slot; 0 = not a watched cliff channel. The ISR compares
+   raw counts: analog_cliff_set() turns the mm thresholds into counts once. */
+static uint16_t cliff_min[ADC_SLOT_COUNT];
+static uint16_t cliff_mm[ADC_SLOT_COUNT];  /* as set, for the CLIFF reply */
+static const uint8_t cliff_bit[ADC_SLOT_COUNT] = {
+	[ADC_SLOT_CLIFF_LEFT]  = CLIFF_LEFT,
+	[ADC_SLOT_CLIFF_FRONT] = CLIFF_FRONT,
+	[ADC_SLOT_CLIFF_RIGHT] = CLIFF_RIGHT,
+};
+static uint8_t          cliff_armed;   /* slot bits: read floor since set/trip */
+static volatile uint8_t cliff_side;    /* latched CLIFF_* bits                 */
+static volatile bool    cliff_pending; /* event not yet taken by the main loop */
+static CliffEvent       cliff_ev;
+
+/* from the ISR: start the brake right away (stores only, the ramp was
+   prepared by the main loop); the main loop drops the job after        */
+static void cliff_trip(uint8_t slot, uint16_t raw)
+{
+	if (!cliff_side)
+	{
+		motors_brake_from_isr();
+		cliff_ev.side = cliff_bit[slot];
+		cliff_ev.t_us = micros32();
+		cliff_ev.raw = raw;
+		cliff_pending = true;
+	}
+	cliff_side |= cliff_bit[slot];
+}
+
+/* Pick the trigger for the next conversion. A step edge couples switching
+   noise into the inputs, so while the step clock runs the conversion starts
+   on Timer-1 compare B, half a period from either edge. At standstill there
+   are no edges and Timer-0 paces the scan. The ADC starts on a rising edge
+   of the source's flag and no ISR clears these flags, so it is cleared
+   first; selecting a source whose flag is set counts as an edge.
+   Interrupts must be off.                                                */
+static inline void adc_arm_trigger(void)
+{
+	if (STEP_CLOCK_RUNNING())
+	{
+		TIFR1 = (1<<OCF1B);
+		ADCSRB = (ADCSRB & ~ADTS_MASK) | ADTS_T1_CMPB;
+	}
+	else
+	{
+		TIFR0 = (1<<OCF0A);
+		ADCSRB = (ADCSRB & ~ADTS_MASK) | ADTS_T0_CMPA;
+	}
+}
+
 /* ------------------------------------------------------- */
 void analog_init(void)
 {
-	/* AVcc reference, right-adjust, start on channel 0 */
+	/* AVcc reference, right-adjust, start on the first slot */
 	ADMUX  = (1<<REFS0);            /* AVcc with ext. cap on AREF */
-	adc_select_channel(0);
+	scan_slot = 0;
+	adc_select_channel(scan_ch[0]);
+
+	/* idle pace: Timer-0 CTC, no interrupt, only the compare flag is used */
+	TCCR0A = (1<<WGM01);
+	OCR0A  = ADC_IDLE_OCR0A;
+	TCCR0B = (1<<CS01) | (1<<CS00);
 
-	/* prescaler, enable, no free-running */
-	ADCSRA = (1<<ADEN) | ADC_PRESCALER_BITS;
+	/* prescaler, enable, auto trigger, conversion-complete interrupt; the
+	   ISR moves the mux on and picks the trigger for the next conversion */
+	adc_arm_trigger();              /* not free running, before ADATE is set */
+	ADCSRA = (1<<ADEN) | (1<<ADATE) | (1<<ADIE) | ADC_PRESCALER_BITS;
 
 	/* Disable digital input buffers on the used analog pins to save power/noise */
 	DIDR0 =  (1<<ADC0D) | (1<<ADC1D) | (1<<ADC4D) | (1<<ADC5D) | (1<<ADC6D);
+
+	analog_cliff_set(CLIFF_MAX_MM_LEFT, CLIFF_MAX_MM_FRONT, CLIFF_MAX_MM_RIGHT);
+	motors_set_fast_stop(CLIFF_STOP_ACC);
+
+	ADCSRA |= (1<<ADSC);            /* first conversion; ISR keeps it going */
 }
 
-/* blocking, software-averaged read ---------------------- */
-uint16_t analog_read_raw(uint8_t channel)
+/* conversion complete: fold it into its slot, start the next channel */
+ISR(ADC_vect)
 {
-	uint32_t acc = 0;
+	uint16_t t0 = irqmon_begin();
+	PROF_BEGIN(PROF_ADC);
+	uint16_t v = ADC;                  /* read ADCL then ADCH       */
+	uint8_t  i = scan_slot;
+	uint8_t  bit = (uint8_t)(1U << i);
 
-	adc_select_channel(channel);
+	if (seeded & bit)
+		avg_q[i] = avg_q[i] - (avg_q[i] >> ADC_AVG_SHIFT) + v;
+	else
+	{
+		avg_q[i] = v << ADC_AVG_SHIFT;
+		seeded |= bit;
+	}
 
-	for (uint8_t i = 0; i < ADC_NUM_SAMPLES; ++i) {
-		ADCSRA |= (1<<ADSC);               /* start conversion          */
-		while (ADCSRA & (1<<ADSC)) {;}     /* wait until ADSC clears    */
-		acc += ADC;                        /* read ADCL then ADCH       */
+	uint16_t thr = cliff_min[i];
+	if (thr)
+	{
+		uint16_t a = avg_q[i] >> ADC_AVG_SHIFT;
+		if (a >= thr)
+			cliff_armed |= bit;
+		else if (cliff_armed & bit) /* floor -> no floor */
+		{
+			cliff_armed &= (uint8_t)~bit;
+			cliff_trip(i, a);
+		}
 	}
-	return (uint16_t)(acc / ADC_NUM_SAMPLES);
+
+	if (++i == ADC_SLOT_COUNT)
+		i = 0;
+	scan_slot = i;
+	adc_select_channel(scan_ch[i]);
+	adc_arm_trigger();
+	PROF_END(PROF_ADC);
+	irqmon_end(IRQ_ADC_ISR, t0);
 }
 
-/* ---------------- convenience wrappers -----------------*/
+/* latest average of a scanned slot -------------------- */
+static inline uint16_t slot_value(uint8_t slot)
+{
+	uint16_t q;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		q = avg_q[slot];
+	}
+	return q >> ADC_AVG_SHIFT;
+}
+
+/* by channel number, for channels outside the fixed getters;
+   0 if the channel is not in ADC_SCAN                       */
+uint16_t analog_read_raw(uint8_t channel)
+{
+	for (uint8_t i = 0; i < ADC_SLOT_COUNT; ++i)
+		if (scan_ch[i] == channel)
+			return slot_value(i);
+	return 0;
+}
+
+/* ---------------- battery ------------------------------*/
+/* mV per count in Q8, folded at compile time: one multiply
+   and a shift per reading instead of two 32-bit divides.
+   The product needs 64 bits (unsigned long is 32 on AVR).  */
+#define BAT_MV_Q8  ((uint32_t)((uint64_t)ADC_AVCC_MV * (BAT_DIV_R1_OHM + BAT_DIV_R2_OHM) * 256U \
+                               / ((uint64_t)BAT_DIV_R2_OHM * 1024U)))
+
+/* full scale (1023 counts) must still fit the uint16_t mV result */
+_Static_assert(BAT_MV_Q8 > 0 && BAT_MV_Q8 <= 65535UL * 256UL / 1023UL,
+               "BAT_MV_Q8 out of range: check ADC_AVCC_MV and BAT_DIV_R*_OHM");
+
 static inline uint16_t to_millivolt(uint16_t adc)
 {
-	/*  (adc * 1100 mV /1023) * scale-factor  */
-	uint32_t mv = (uint32_t)adc * 1100UL / 1023UL;   /* ? AVcc=3.3 V ? update */
-	mv = mv * BAT_DIV_FACTOR_NUM / BAT_DIV_FACTOR_DEN;
-	return (uint16_t)mv;
+	return (uint16_t)(((uint32_t)adc * BAT_MV_Q8) >> 8);
+}
+
+/* filtered mV in Q8, 0 = not seeded yet */
+static uint32_t bat_q8[2];
+
+static void bat_filter(uint8_t i, uint16_t mv)
+{
+	uint32_t x = (uint32_t)mv << 8;
+
+	if (bat_q8[i] == 0)
+		bat_q8[i] = x;
+	else if (x < bat_q8[i])
+		bat_q8[i] -= (bat_q8[i] - x) >> BAT_FALL_SHIFT;
+	else
+		bat_q8[i] += (x - bat_q8[i]) >> BAT_RISE_SHIFT;
+}
+
+void analog_update(void)
+{
+	/* the step clock stopped while the scan waited for its compare B:
+	   move it over to the idle pace                                   */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if ((ADCSRB & ADTS_MASK) == ADTS_T1_CMPB && !STEP_CLOCK_RUNNING())
+			adc_arm_trigger();
+	}
+
+	bat_filter(0, to_millivolt(slot_value(ADC_SLOT_BAT_MAIN)));
+	bat_filter(1, to_millivolt(slot_value(ADC_SLOT_BAT_AUX)));
 }
 
 uint16_t analog_get_battery_1_mV(void)
 {
-	return to_millivolt(analog_read_raw(ADC_CH_BAT_MAIN));
+	return (uint16_t)(bat_q8[0] >> 8);
 }
 
 uint16_t analog_get_battery_2_mV(void)
 {
-	return to_millivolt(analog_read_raw(ADC_CH_BAT_AUX));
+	return (uint16_t)(bat_q8[1] >> 8);
+}
+
+uint16_t analog_get_cliff_left_mm (void){ return sharp_mm(slot_value(ADC_SLOT_CLIFF_LEFT));  }
+uint16_t analog_get_cliff_front_mm(void){ return sharp_mm(slot_value(ADC_SLOT_CLIFF_FRONT)); }
+uint16_t analog_get_cliff_right_mm(void){ return sharp_mm(slot_value(ADC_SLOT_CLIFF_RIGHT)); }
+
+/* ---------------- cliff fast stop ----------------------*/
+/* 0 stays 0 (off); anything else is kept inside the rated range, where
+   the curve still tells floor from no floor                          */
+static uint16_t cliff_clamp_mm(uint16_t mm)
+{
+	if (mm == 0)
+		return 0;
+	if (mm <= SHARP_MM_MIN)
+		return SHARP_MM_MIN + 1;
+	if (mm >= SHARP_MM_MAX)
+		return SHARP_MM_MAX - 1;
+	return mm;
+}
+
+void analog_cliff_set(uint16_t left, uint16_t front, uint16_t right)
+{
+	const uint8_t slot[3] = { ADC_SLOT_CLIFF_LEFT, ADC_SLOT_CLIFF_FRONT, ADC_SLOT_CLIFF_RIGHT };
+	const uint16_t mm[3] = { left, front, right };
+	uint16_t raw[3];
+
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		cliff_mm[slot[k]] = cliff_clamp_mm(mm[k]);
+		raw[k] = cliff_mm[slot[k]] ? sharp_raw_at_mm(cliff_mm[slot[k]]) : 0;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t k = 0; k < 3; ++k)
+			cliff_min[slot[k]] = raw[k];
+		cliff_armed = 0; /* re-arm on the next floor reading */
+	}
 }
 
-uint16_t analog_get_cliff_left (void){ return analog_read_raw(ADC_CH_CLIFF_LEFT);  }
-uint16_t analog_get_cliff_front(void){ return analog_read_raw(ADC_CH_CLIFF_FRONT); }
-uint16_t analog_get_cliff_right(void){ return analog_read_raw(ADC_CH_CLIFF_RIGHT); }
+uint16_t analog_cliff_threshold(uint8_t slot) { return cliff_mm[slot]; }
+
+bool analog_cliff_take(CliffEvent *e)
+{
+	bool got = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (cliff_pending)
+		{
+			*e = cliff_ev;
+			cliff_pending = false;
+			got = true;
+		}
+	}
+	return got;
+}
+
+bool analog_cliff_fault(void) { return cliff_side != 0; }
+
+/* a channel still over the edge stays disarmed, so the robot can back off */
+void analog_cliff_clear(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		cliff_side = 0;
+		cliff_pending = false;
+	}
+}
@@ -5,6 +5,7 @@
  */
 
 #include "bno055_ll.h"
+#include "prof.h"
 
 static const uint8_t offset_reg_first = 0x55;  /* ACCEL_OFFSET_X_LSB */
 static const uint8_t offset_reg_last  = 0x6A;  /* MAG_RADIUS_MSB     */
@@ -168,6 +169,7 @@ bool bno055_init(void)
 
 void bno055_get_euler(int16_t *h, int16_t *r, int16_t *p)
 {
+    PROF_BEGIN(PROF_IMU);
     uint8_t buf[6];
     if (bno055_read(0x1A, buf, 6))
     { /* EULER_H_LSB */
@@ -175,11 +177,13 @@ void bno055_get_euler(int16_t *h, int16_t *r, int16_t *p)
         *r = (int16_t)(buf[2] | ((uint16_t)buf[3] << 8));
         *p = (int16_t)(buf[4] | ((uint16_t)buf[5] << 8));
     }
+    PROF_END(PROF_IMU);
 }
 
 //decide not needed later
 void bno055_get_omega(int16_t *gx, int16_t *gy, int16_t *gz)
 {
+	PROF_BEGIN(PROF_IMU);
 	uint8_t buf[6];
 	if (bno055_read(0x14, buf, 6))            /* GYRO_DATA_X_LSB */
 	{
@@ -187,11 +191,13 @@ void bno055_get_omega(int16_t *gx, int16_t *gy, int16_t *gz)
 		*gy = (int16_t)(buf[2] | ((uint16_t)buf[3] << 8));
 		*gz = (int16_t)(buf[4] | ((uint16_t)buf[5] << 8));
 	}
+	PROF_END(PROF_IMU);
 }
 
 /* 1 LSB = 1/100 m s-2   */
 void bno055_get_accel(int16_t *ax, int16_t *ay, int16_t *az)
 {
+	PROF_BEGIN(PROF_IMU);
 	uint8_t buf[6];
 	if (bno055_read(0x28, buf, 6))              /* LINEAR_ACCEL_DATA_X_LSB */
 	{
@@ -199,6 +205,7 @@ void bno055_get_accel(int16_t *ax, int16_t *ay, int16_t *az)
 		*ay = (int16_t)(buf[2] | ((uint16_t)buf[3] << 8));
 		*az = (int16_t)(buf[4] | ((uint16_t)buf[5] << 8));
 	}
+	PROF_END(PROF_IMU);
 }
 
 bool bno055_is_fully_calibrated(void)
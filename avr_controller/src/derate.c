@@ -0,0 +1,102 @@
+/* -----------------------------------------------------------------------------
+ * derate.c  Acceleration / top-speed derating for the motion profiler
+ *
+ * Tilt: the fraction of motor torque left for accelerating on a slope falls
+ * with sin(tilt).  The curve is tabulated at compile time every 2 degrees
+ * (Q8, 256 = 1.0) and read with an integer lerp, so the per-tick cost is a
+ * couple of shifts and one multiply.
+ *
+ * Battery: linear in the filtered pack voltage between BAT_DERATE_START_MV
+ * and BAT_DERATE_END_MV; the slope is a compile-time Q16 constant, so no
+ * division at run time.  Tilt and battery are kept apart and the lower of
+ * the two wins.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include "config.h"
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include "derate.h"
+
+/* sin() as a constant expression: x - x^3/6 is within 0.1 % up to 30 deg */
+#define DEG2RAD(d)          ((d) * 0.01745329f)
+#define CSIN(d)             (DEG2RAD(d) - DEG2RAD(d) * DEG2RAD(d) * DEG2RAD(d) / 6.0f)
+
+/* 1.0 inside the dead band, min_scale from TILT_LIMIT_DEG on, linear in sin() between */
+#define TILT_FRAC(d)        ((CSIN(d) - CSIN(TILT_DEADBAND_DEG)) / (CSIN(TILT_LIMIT_DEG) - CSIN(TILT_DEADBAND_DEG)))
+#define TILT_SCALE(d, min)  ((d) <= TILT_DEADBAND_DEG ? 1.0f : (d) >= TILT_LIMIT_DEG ? (min) : 1.0f - TILT_FRAC(d) * (1.0f - (min)))
+#define TILT_Q8(d, min)     ((uint16_t)(TILT_SCALE((float)(d), (min)) * 256.0f + 0.5f))
+
+#define TILT_ROW(min) \
+	{ TILT_Q8(0, min),  TILT_Q8(2, min),  TILT_Q8(4, min),  TILT_Q8(6, min),  \
+	  TILT_Q8(8, min),  TILT_Q8(10, min), TILT_Q8(12, min), TILT_Q8(14, min), \
+	  TILT_Q8(16, min), TILT_Q8(18, min), TILT_Q8(20, min), TILT_Q8(22, min), \
+	  TILT_Q8(24, min), TILT_Q8(26, min), TILT_Q8(28, min), TILT_Q8(30, min), \
+	  TILT_Q8(30, min) }
+
+#define TILT_STEP_SHIFT  5          /* 2 deg = 32 counts of deg*16 */
+#define TILT_TABLE_LEN   17
+
+static const uint16_t tilt_acc_tab[TILT_TABLE_LEN] PROGMEM = TILT_ROW(TILT_MIN_ACC_SCALE);
+static const uint16_t tilt_speed_tab[TILT_TABLE_LEN] PROGMEM = TILT_ROW(TILT_MIN_SPEED_SCALE);
+
+/* Q8 floor and per-mV slope (Q16) of the battery curve */
+#define BAT_MIN_Q8(min)     ((uint16_t)((min) * 256.0f + 0.5f))
+#define BAT_SLOPE_Q16(min)  ((uint32_t)((256.0f - BAT_MIN_Q8(min)) * 65536.0f / (BAT_DERATE_START_MV - BAT_DERATE_END_MV)))
+
+static uint16_t tilt_acc_q8 = 256;
+static uint16_t tilt_speed_q8 = 256;
+static uint16_t bat_acc_q8 = 256;
+static uint16_t bat_speed_q8 = 256;
+
+/* ====================  helpers =================== */
+static inline uint16_t abs16(int16_t v) { return (v < 0) ? (uint16_t)(-v) : (uint16_t)v; }
+static inline uint16_t min16(uint16_t a, uint16_t b) { return (a < b) ? a : b; }
+
+static uint16_t table_lerp(const uint16_t *table, uint16_t tilt16)
+{
+	uint8_t i = tilt16 >> TILT_STEP_SHIFT;
+	if (i >= TILT_TABLE_LEN - 1)
+		return pgm_read_word(&table[TILT_TABLE_LEN - 1]);
+
+	uint8_t frac = tilt16 & ((1 << TILT_STEP_SHIFT) - 1);
+	int16_t a = pgm_read_word(&table[i]);
+	int16_t b = pgm_read_word(&table[i + 1]);
+	return a + (((b - a) * frac) >> TILT_STEP_SHIFT);
+}
+
+/* ====================  API =================== */
+void derate_update_tilt(int16_t roll16, int16_t pitch16)
+{
+	/* |tilt| ~ max + min/2 : octagonal estimate of sqrt(roll^2 + pitch^2) */
+	uint16_t r = abs16(roll16);
+	uint16_t p = abs16(pitch16);
+	uint16_t tilt16 = (r > p) ? r + (p >> 1) : p + (r >> 1);
+
+	tilt_acc_q8 = table_lerp(tilt_acc_tab, tilt16);
+	tilt_speed_q8 = table_lerp(tilt_speed_tab, tilt16);
+}
+
+void derate_update_battery(uint16_t mv)
+{
+	if (mv < BAT_ABSENT_MV || mv >= BAT_DERATE_START_MV)
+	{
+		bat_acc_q8 = 256;
+		bat_speed_q8 = 256;
+	}
+	else if (mv <= BAT_DERATE_END_MV)
+	{
+		bat_acc_q8 = BAT_MIN_Q8(BAT_MIN_ACC_SCALE);
+		bat_speed_q8 = BAT_MIN_Q8(BAT_MIN_SPEED_SCALE);
+	}
+	else
+	{
+		uint32_t dv = mv - BAT_DERATE_END_MV;
+		bat_acc_q8 = BAT_MIN_Q8(BAT_MIN_ACC_SCALE) + (uint16_t)((dv * BAT_SLOPE_Q16(BAT_MIN_ACC_SCALE)) >> 16);
+		bat_speed_q8 = BAT_MIN_Q8(BAT_MIN_SPEED_SCALE) + (uint16_t)((dv * BAT_SLOPE_Q16(BAT_MIN_SPEED_SCALE)) >> 16);
+	}
+}
+
+float derate_acc_scale(void) { return min16(tilt_acc_q8, bat_acc_q8) * (1.0f / 256.0f); }
+float derate_speed_scale(void) { return min16(tilt_speed_q8, bat_speed_q8) * (1.0f / 256.0f); }
@@ -11,6 +11,8 @@
 #include <util/atomic.h>
 #include "config.h"
 #include "encoder.h"
+#include "prof.h"
+#include "irqmon.h"
 
 /* private state */
 static volatile int32_t left_cnt, right_cnt;
@@ -28,7 +30,7 @@ static float rot_change_deg = 0.0f;
 static float robot_distance_mm = 0.0f;
 static float robot_angle_deg = 0.0f;
 
-static uint64_t prev_ts_us = 0;
+static uint32_t prev_ts_us = 0;
 static uint32_t loop_dt_us = 1;
 
 /* ---------- helpers ---------- */
@@ -114,28 +116,36 @@ void encoder_init(void)
 /* ------------ LEFT ISRs (INT2 & INT3) ------------- */
 ISR(INT2_vect)
 {
+	PROF_BEGIN(PROF_ENC_L);
 	uint8_t a = (ENC_L_A_PINREG & _BV(ENC_L_A_BIT)) ? 1 : 0;
 	uint8_t b = (ENC_L_B_PINREG & _BV(ENC_L_B_BIT)) ? 1 : 0;
 	enc_handle(&left_cnt, &left_last_state, a, b);
+	PROF_END(PROF_ENC_L);
 }
 
 ISR(INT3_vect)
 {
+	PROF_BEGIN(PROF_ENC_L);
 	uint8_t a = (ENC_L_A_PINREG & _BV(ENC_L_A_BIT)) ? 1 : 0;
 	uint8_t b = (ENC_L_B_PINREG & _BV(ENC_L_B_BIT)) ? 1 : 0;
 	enc_handle(&left_cnt, &left_last_state, a, b);
+	PROF_END(PROF_ENC_L);
 }
 
 ISR(INT6_vect)
 {
+	PROF_BEGIN(PROF_ENC_R);
 	uint8_t a = (ENC_R_A_PINREG & _BV(ENC_R_A_BIT)) ? 1 : 0;
 	uint8_t b = (ENC_R_B_PINREG & _BV(ENC_R_B_BIT)) ? 1 : 0;
 	enc_handle(&right_cnt, &right_last_state, a, b);
+	PROF_END(PROF_ENC_R);
 }
 
 /* ------------ RIGHT + EMERGENCY (PCINT0) ------------- */
 ISR(PCINT0_vect)
 {
+	PROF_BEGIN(PROF_ENC_R);
+
 	/* 1) emergency check */
 	if (!(EMG_BTN_PINREG & _BV(EMG_BTN_BIT)))
 	{
@@ -146,37 +156,47 @@ ISR(PCINT0_vect)
 	uint8_t a = (ENC_R_A_PINREG & _BV(ENC_R_A_BIT)) ? 1 : 0;
 	uint8_t b = (ENC_R_B_PINREG & _BV(ENC_R_B_BIT)) ? 1 : 0;
 	enc_handle(&right_cnt, &right_last_state, a, b);
+
+	PROF_END(PROF_ENC_R);
 }
 
 /* =========== public API (unchanged) =========== */
 int32_t encoder_get_left(void)
 {
+	uint8_t s = SREG;
 	cli();
+	uint16_t t0 = irqmon_begin();
 	int32_t c = left_cnt;
-	sei();
+	irqmon_end(IRQ_ENC_GET, t0);
+	SREG = s;
 	return c;
 }
 
 int32_t encoder_get_right(void)
 {
+	uint8_t s = SREG;
 	cli();
+	uint16_t t0 = irqmon_begin();
 	int32_t c = right_cnt;
-	sei();
+	irqmon_end(IRQ_ENC_GET, t0);
+	SREG = s;
 	return c;
 }
 
 void encoder_reset_left(void)
 {
+	uint8_t s = SREG;
 	cli();
 	left_cnt = 0;
-	sei();
+	SREG = s;
 }
 
 void encoder_reset_right(void)
 {
+	uint8_t s = SREG;
 	cli();
 	right_cnt = 0;
-	sei();
+	SREG = s;
 }
 
 void encoder_reset_both(void)
@@ -205,15 +225,15 @@ void encoder_odometry_reset(void)
 		fwd_change_mm = rot_change_deg = 0.0f;
 		robot_distance_mm = robot_angle_deg = 0.0f;
 
-		prev_ts_us = micros64(); /* ← use global timer0 based time-base */
+		prev_ts_us = micros32(); /* ← use global timer3 based time-base */
 		loop_dt_us = 1;
 	}
 }
 
 void encoder_odometry_update(void)
 {
-	uint64_t now_us = micros64();
-	loop_dt_us = (uint32_t)(now_us - prev_ts_us);
+	uint32_t now_us = micros32();
+	loop_dt_us = now_us - prev_ts_us; /* wraps cleanly */
 	if (loop_dt_us == 0)
 		loop_dt_us = 1;
 	prev_ts_us = now_us;
@@ -0,0 +1,69 @@
+/* -----------------------------------------------------------------------------
+ * follow.c  Stall / lost-step detection
+ *
+ * The step ISR counts every pulse it emits; the encoders count what the wheel
+ * actually did.  Their difference is the following error.  The closed-loop
+ * drivers keep it to a fraction of a millimetre, so a few millimetres means a
+ * stalled wheel or steps the driver did not take.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "encoder.h"
+#include "motors.h"
+#include "follow.h"
+
+#define MM_PER_STEP   (1.0f / STEPS_PER_MM)     /* finest microsteps */
+#define MM_PER_COUNT  (MM_PER_ROTATION / (4.0f * ENCODER_PPR * GEAR_RATIO))
+#define STEPS_PER_COUNT ((float)STEPS_PER_REV * STEP_MICRO_MAX / (4.0f * ENCODER_PPR))
+
+static float   err_left_mm;
+static float   err_right_mm;
+static uint8_t over_ticks;
+static uint8_t fault_side;
+
+bool follow_update(void)
+{
+	err_left_mm  = encoder_get_left()  * MM_PER_COUNT - motors_get_steps_left()  * MM_PER_STEP;
+	err_right_mm = encoder_get_right() * MM_PER_COUNT - motors_get_steps_right() * MM_PER_STEP;
+
+	if (!FOLLOW_ENABLED || fault_side)
+		return false;
+
+	uint8_t side = (fabsf(err_left_mm)  > FOLLOW_MAX_ERR_MM ? FOLLOW_LEFT  : 0)
+				 | (fabsf(err_right_mm) > FOLLOW_MAX_ERR_MM ? FOLLOW_RIGHT : 0);
+
+	if (!side)
+	{
+		over_ticks = 0;
+		return false;
+	}
+	if (++over_ticks < FOLLOW_TRIP_TICKS)
+		return false;
+
+	fault_side = side;
+	return true;
+}
+
+bool follow_fault(void) { return fault_side != 0; }
+uint8_t follow_fault_side(void) { return fault_side; }
+
+void follow_clear(void)
+{
+	/* the wheel is where the encoder says: drop the lost steps from the count */
+	float l = encoder_get_left()  * STEPS_PER_COUNT;
+	float r = encoder_get_right() * STEPS_PER_COUNT;
+	motors_set_steps((int32_t)(l + (l >= 0.0f ? 0.5f : -0.5f)),
+					 (int32_t)(r + (r >= 0.0f ? 0.5f : -0.5f)));
+
+	err_left_mm = err_right_mm = 0.0f;
+	over_ticks = 0;
+	fault_side = 0;
+}
+
+float follow_error_left_mm(void) { return err_left_mm; }
+float follow_error_right_mm(void) { return err_right_mm; }
@@ -0,0 +1,42 @@
+/* -----------------------------------------------------------------------------
+ * irqmon.c  Interrupts-off watermark per call site
+ *
+ * The measuring is inline (irqmon.h); this file holds the watermarks and
+ * prints them for the IRQ service command.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <util/atomic.h>
+#include "irqmon.h"
+
+volatile uint16_t irqmon_max[IRQ_SITE_COUNT];
+
+static const char *const irqmon_names[IRQ_SITE_COUNT] = {
+	[IRQ_USB_TX]    = "USB_TX",
+	[IRQ_USB_RX]    = "USB_RX",
+	[IRQ_USB_WRITE] = "USB_WRITE",
+	[IRQ_USB_ISR]   = "USB_ISR",
+	[IRQ_TIME]      = "TIME",
+	[IRQ_ENC_GET]   = "ENC_GET",
+	[IRQ_STEP_CMD]  = "STEP_CMD",
+	[IRQ_STEP_ISR]  = "STEP_ISR",
+	[IRQ_ADC_ISR]   = "ADC_ISR",
+};
+
+int irqmon_format(uint8_t site, char *buf, size_t n, bool reset)
+{
+	uint16_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		t = irqmon_max[site];
+		if (reset)
+			irqmon_max[site] = 0;
+	}
+
+	/* ticks are 0.5 us */
+	return snprintf(buf, n, "IRQ %s max=%u.%u us\r\n", irqmon_names[site], t >> 1, (t & 1U) * 5U);
+}
@@ -7,6 +7,8 @@
 
 #define USB_SERIAL_PRIVATE_INCLUDE
 #include "m_usb.h"
+#include "trace.h"
+#include "irqmon.h"
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -82,6 +84,7 @@ int8_t usb_serial_set_control(uint8_t signals); // set DSR, DCD, RI, etc
 #define CDC_RX_BUFFER EP_DOUBLE_BUFFER
 #define CDC_TX_SIZE 64
 #define CDC_TX_BUFFER EP_DOUBLE_BUFFER
+#define CDC_TX_CHUNK 8 // bytes copied per interrupts-off section in usb_serial_write()
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
 	0,
@@ -284,14 +287,17 @@ char m_usb_isconnected(void)
 char m_usb_rx_char(void)
 {
 	uint8_t c, intr_state;
+	uint16_t t0;
 
 	// interrupts are disabled so these functions can be
 	// used from the main program or interrupt context,
 	// even both in the same program!
 	intr_state = SREG;
 	cli();
+	t0 = irqmon_begin();
 	if (!usb_configuration)
 	{
+		irqmon_end(IRQ_USB_RX, t0);
 		SREG = intr_state;
 		return -1;
 	}
@@ -299,6 +305,7 @@ char m_usb_rx_char(void)
 	if (!(UEINTX & (1 << RWAL)))
 	{
 		// no data in buffer
+		irqmon_end(IRQ_USB_RX, t0);
 		SREG = intr_state;
 		return -1;
 	}
@@ -307,6 +314,7 @@ char m_usb_rx_char(void)
 	// if buffer completely used, release it
 	if (!(UEINTX & (1 << RWAL)))
 		UEINTX = 0x6B;
+	irqmon_end(IRQ_USB_RX, t0);
 	SREG = intr_state;
 	return (char)c;
 }
@@ -315,14 +323,17 @@ char m_usb_rx_char(void)
 unsigned char m_usb_rx_available(void)
 {
 	uint8_t n = 0, intr_state;
+	uint16_t t0;
 
 	intr_state = SREG;
 	cli();
+	t0 = irqmon_begin();
 	if (usb_configuration)
 	{
 		UENUM = CDC_RX_ENDPOINT;
 		n = UEBCLX;
 	}
+	irqmon_end(IRQ_USB_RX, t0);
 	SREG = intr_state;
 	return (unsigned char)n;
 }
@@ -331,16 +342,19 @@ unsigned char m_usb_rx_available(void)
 void m_usb_rx_flush(void)
 {
 	uint8_t intr_state;
+	uint16_t t0;
 
 	if (usb_configuration)
 	{
 		intr_state = SREG;
 		cli();
+		t0 = irqmon_begin();
 		UENUM = CDC_RX_ENDPOINT;
 		while ((UEINTX & (1 << RWAL)))
 		{
 			UEINTX = 0x6B;
 		}
+		irqmon_end(IRQ_USB_RX, t0);
 		SREG = intr_state;
 	}
 }
@@ -349,6 +363,7 @@ void m_usb_rx_flush(void)
 char m_usb_tx_char(unsigned char c)
 {
 	uint8_t timeout, intr_state;
+	uint16_t t0;
 
 	// if we're not online (enumerated and configured), error
 	if (!usb_configuration)
@@ -358,12 +373,14 @@ char m_usb_tx_char(unsigned char c)
 	// even both in the same program!
 	intr_state = SREG;
 	cli();
+	t0 = irqmon_begin();
 	UENUM = CDC_TX_ENDPOINT;
 	// if we gave up due to timeout before, don't wait again
 	if (transmit_previous_timeout)
 	{
 		if (!(UEINTX & (1 << RWAL)))
 		{
+			irqmon_end(IRQ_USB_TX, t0);
 			SREG = intr_state;
 			return -1;
 		}
@@ -376,6 +393,7 @@ char m_usb_tx_char(unsigned char c)
 		// are we ready to transmit?
 		if (UEINTX & (1 << RWAL))
 			break;
+		irqmon_end(IRQ_USB_TX, t0);
 		SREG = intr_state;
 		// have we waited too long?  This happens if the user
 		// is not running an application that is listening
@@ -390,14 +408,19 @@ char m_usb_tx_char(unsigned char c)
 		// get ready to try checking again
 		intr_state = SREG;
 		cli();
+		t0 = irqmon_begin();
 		UENUM = CDC_TX_ENDPOINT;
 	}
 	// actually write the byte into the FIFO
 	UEDATX = (uint8_t)c;
 	// if this completed a packet, transmit it now!
 	if (!(UEINTX & (1 << RWAL)))
+	{
 		UEINTX = 0x3A;
+		TRACE_MARK(TR_USB_TX, 1);
+	}
 	transmit_flush_timer = TRANSMIT_FLUSH_TIMEOUT;
+	irqmon_end(IRQ_USB_TX, t0);
 	SREG = intr_state;
 	return 0;
 }
@@ -407,15 +430,18 @@ char m_usb_tx_char(unsigned char c)
 int8_t usb_serial_putchar_nowait(uint8_t c)
 {
 	uint8_t intr_state;
+	uint16_t t0;
 
 	if (!usb_configuration)
 		return -1;
 	intr_state = SREG;
 	cli();
+	t0 = irqmon_begin();
 	UENUM = CDC_TX_ENDPOINT;
 	if (!(UEINTX & (1 << RWAL)))
 	{
 		// buffer is full
+		irqmon_end(IRQ_USB_TX, t0);
 		SREG = intr_state;
 		return -1;
 	}
@@ -425,6 +451,7 @@ int8_t usb_serial_putchar_nowait(uint8_t c)
 	if (!(UEINTX & (1 << RWAL)))
 		UEINTX = 0x3A;
 	transmit_flush_timer = TRANSMIT_FLUSH_TIMEOUT;
+	irqmon_end(IRQ_USB_TX, t0);
 	SREG = intr_state;
 	return 0;
 }
@@ -444,6 +471,7 @@ int8_t usb_serial_putchar_nowait(uint8_t c)
 int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 {
 	uint8_t timeout, intr_state, write_size;
+	uint16_t t0;
 
 	// if we're not online (enumerated and configured), error
 	if (!usb_configuration)
@@ -453,18 +481,22 @@ int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 	// even both in the same program!
 	intr_state = SREG;
 	cli();
+	t0 = irqmon_begin();
 	UENUM = CDC_TX_ENDPOINT;
 	// if we gave up due to timeout before, don't wait again
 	if (transmit_previous_timeout)
 	{
 		if (!(UEINTX & (1 << RWAL)))
 		{
+			irqmon_end(IRQ_USB_WRITE, t0);
 			SREG = intr_state;
 			return -1;
 		}
 		transmit_previous_timeout = 0;
 	}
-	// each iteration of this loop transmits a packet
+	// each iteration of this loop copies at most CDC_TX_CHUNK bytes, then
+	// lets pending interrupts in: a whole 64-byte packet with interrupts
+	// off held the encoder ISRs back for about 16 us
 	while (size)
 	{
 		// wait for the FIFO to be ready to accept data
@@ -474,6 +506,7 @@ int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 			// are we ready to transmit?
 			if (UEINTX & (1 << RWAL))
 				break;
+			irqmon_end(IRQ_USB_WRITE, t0);
 			SREG = intr_state;
 			// have we waited too long?  This happens if the user
 			// is not running an application that is listening
@@ -488,136 +521,21 @@ int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 			// get ready to try checking again
 			intr_state = SREG;
 			cli();
+			t0 = irqmon_begin();
 			UENUM = CDC_TX_ENDPOINT;
 		}
 
 		// compute how many bytes will fit into the next packet
 		write_size = CDC_TX_SIZE - UEBCLX;
+		if (write_size > CDC_TX_CHUNK)
+			write_size = CDC_TX_CHUNK;
 		if (write_size > size)
 			write_size = size;
 		size -= write_size;
 
-		// write the packet
+		// write the chunk
 		switch (write_size)
 		{
-#if (CDC_TX_SIZE == 64)
-		case 64:
-			UEDATX = *buffer++;
-		case 63:
-			UEDATX = *buffer++;
-		case 62:
-			UEDATX = *buffer++;
-		case 61:
-			UEDATX = *buffer++;
-		case 60:
-			UEDATX = *buffer++;
-		case 59:
-			UEDATX = *buffer++;
-		case 58:
-			UEDATX = *buffer++;
-		case 57:
-			UEDATX = *buffer++;
-		case 56:
-			UEDATX = *buffer++;
-		case 55:
-			UEDATX = *buffer++;
-		case 54:
-			UEDATX = *buffer++;
-		case 53:
-			UEDATX = *buffer++;
-		case 52:
-			UEDATX = *buffer++;
-		case 51:
-			UEDATX = *buffer++;
-		case 50:
-			UEDATX = *buffer++;
-		case 49:
-			UEDATX = *buffer++;
-		case 48:
-			UEDATX = *buffer++;
-		case 47:
-			UEDATX = *buffer++;
-		case 46:
-			UEDATX = *buffer++;
-		case 45:
-			UEDATX = *buffer++;
-		case 44:
-			UEDATX = *buffer++;
-		case 43:
-			UEDATX = *buffer++;
-		case 42:
-			UEDATX = *buffer++;
-		case 41:
-			UEDATX = *buffer++;
-		case 40:
-			UEDATX = *buffer++;
-		case 39:
-			UEDATX = *buffer++;
-		case 38:
-			UEDATX = *buffer++;
-		case 37:
-			UEDATX = *buffer++;
-		case 36:
-			UEDATX = *buffer++;
-		case 35:
-			UEDATX = *buffer++;
-		case 34:
-			UEDATX = *buffer++;
-		case 33:
-			UEDATX = *buffer++;
-#endif
-#if (CDC_TX_SIZE >= 32)
-		case 32:
-			UEDATX = *buffer++;
-		case 31:
-			UEDATX = *buffer++;
-		case 30:
-			UEDATX = *buffer++;
-		case 29:
-			UEDATX = *buffer++;
-		case 28:
-			UEDATX = *buffer++;
-		case 27:
-			UEDATX = *buffer++;
-		case 26:
-			UEDATX = *buffer++;
-		case 25:
-			UEDATX = *buffer++;
-		case 24:
-			UEDATX = *buffer++;
-		case 23:
-			UEDATX = *buffer++;
-		case 22:
-			UEDATX = *buffer++;
-		case 21:
-			UEDATX = *buffer++;
-		case 20:
-			UEDATX = *buffer++;
-		case 19:
-			UEDATX = *buffer++;
-		case 18:
-			UEDATX = *buffer++;
-		case 17:
-			UEDATX = *buffer++;
-#endif
-#if (CDC_TX_SIZE >= 16)
-		case 16:
-			UEDATX = *buffer++;
-		case 15:
-			UEDATX = *buffer++;
-		case 14:
-			UEDATX = *buffer++;
-		case 13:
-			UEDATX = *buffer++;
-		case 12:
-			UEDATX = *buffer++;
-		case 11:
-			UEDATX = *buffer++;
-		case 10:
-			UEDATX = *buffer++;
-		case 9:
-			UEDATX = *buffer++;
-#endif
 		case 8:
 			UEDATX = *buffer++;
 		case 7:
@@ -640,9 +558,21 @@ int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 		}
 		// if this completed a packet, transmit it now!
 		if (!(UEINTX & (1 << RWAL)))
+		{
 			UEINTX = 0x3A;
+			TRACE_MARK(TR_USB_TX, 1);
+		}
 		transmit_flush_timer = TRANSMIT_FLUSH_TIMEOUT;
+
+		// open the window; the ISRs may move UENUM or flush this bank
+		irqmon_end(IRQ_USB_WRITE, t0);
+		SREG = intr_state;
+		intr_state = SREG;
+		cli();
+		t0 = irqmon_begin();
+		UENUM = CDC_TX_ENDPOINT;
 	}
+	irqmon_end(IRQ_USB_WRITE, t0);
 	SREG = intr_state;
 	return 0;
 }
@@ -654,15 +584,19 @@ int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 void m_usb_tx_push(void)
 {
 	uint8_t intr_state;
+	uint16_t t0;
 
 	intr_state = SREG;
 	cli();
+	t0 = irqmon_begin();
 	if (transmit_flush_timer)
 	{
 		UENUM = CDC_TX_ENDPOINT;
 		UEINTX = 0x3A;
 		transmit_flush_timer = 0;
+		TRACE_MARK(TR_USB_TX, 0);
 	}
+	irqmon_end(IRQ_USB_TX, t0);
 	SREG = intr_state;
 }
 
@@ -749,6 +683,7 @@ int8_t usb_serial_set_control(uint8_t signals)
 ISR(USB_GEN_vect)
 {
 	uint8_t intbits, t;
+	uint16_t t0 = irqmon_begin();
 
 	intbits = UDINT;
 	UDINT = 0;
@@ -778,6 +713,7 @@ ISR(USB_GEN_vect)
 			}
 		}
 	}
+	irqmon_end(IRQ_USB_ISR, t0);
 }
 
 // Misc functions to wait for ready and send/receive packets
@@ -804,7 +740,16 @@ static inline void usb_ack_out(void)
 // other endpoints are manipulated by the user-callable
 // functions, and the start-of-frame interrupt.
 //
+static void usb_com_service(void);
+
 ISR(USB_COM_vect)
+{
+	uint16_t t0 = irqmon_begin();
+	usb_com_service();
+	irqmon_end(IRQ_USB_ISR, t0);
+}
+
+static void usb_com_service(void)
 {
 	uint8_t intbits;
 	const uint8_t *list;
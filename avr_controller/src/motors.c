@@ -9,62 +9,777 @@
 #include <avr/interrupt.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <math.h>
 #include "motors.h"
 #include "config.h"
+#include "recip.h"
+#include "prof.h"
+#include "irqmon.h"
+
+/* the master step clock: Timer-1 in CTC mode, one compare ISR per edge */
+typedef struct {
+	volatile uint8_t  *tccrb;
+	volatile uint16_t *ocra;
+	volatile uint16_t *ocrb;    /* ADC trigger: the sample lands half-way between two edges */
+	volatile uint16_t *tcnt;
+} StepTimer;
+
+typedef struct {
+	uint16_t top;
+	uint16_t frac;              /* fractional part of TOP+1, 1/65536 tick */
+	uint8_t  cs;                /* 0 = stopped */
+} StepTiming;
+
+/* half-step periods carry STEP_C_FRAC_BITS fraction bits (Q6 CPU cycles) */
+#define C_SCALE   (1UL << STEP_C_FRAC_BITS)
+#define C_MAX     (STEP_HALF_PERIOD_MAX << STEP_C_FRAC_BITS)
+
+/* Step rates [steps/s] are Q12 and accelerations [steps/s^2] Q8 integers
+ * in here. The float command is scaled once, and every later quotient goes
+ * through the reciprocal table, so motors_update() has no division.
+ * A Q8 rate was up to 13 ppm off at 300 pulses/s (97 mm/s with 200
+ * pulses/rev); Q12 is under 1 ppm there and still fits 10 m/s at 1/16.
+ * The ramp needs no such precision, and a Q8 acceleration keeps a
+ * standstill-to-full-speed step in one tick within 32 bits.            */
+#define RATE_SCALE   4096.0f
+#define ACC_SCALE    256.0f
+#define RATE_ACC_SH  4   /* Q12 rate change -> Q8 */
+#define RATE_MIN_Q12 ((uint32_t)(STEP_RATE_MIN * RATE_SCALE))
+#define ACC_MIN_Q8   ((uint32_t)(STEP_RAMP_MIN_ACC * ACC_SCALE))
+#define MM_TO_Q12    (STEPS_PER_MM * RATE_SCALE)
+#define MM_TO_ACC_Q8 (STEPS_PER_MM * ACC_SCALE)
+#if DRIVE_KINEMATICS == DRIVE_MECANUM
+#define TURN_ARM_MM  (WHEEL_BASE_MM + WHEEL_AXLE_BASE_MM)  /* 2 (lx + ly) */
+#else
+#define TURN_ARM_MM  WHEEL_BASE_MM
+#endif
+#define DPS_TO_Q12   (TURN_ARM_MM * (float)M_PI / 360.0f * STEPS_PER_MM * RATE_SCALE)
+
+/* c = F_CPU * 64 / (2 * rate) = (F_CPU << 17) / rate_q12 */
+#define C_RATE_SHIFT 17
+/* first AVR446 step c0 = 0.676 * F_CPU * sqrt(2 / a) / 2 = C0_K16 * 16 / sqrt(acc_q8) */
+#define C0_K16       ((uint32_t)(0.676 * 0.5 * F_CPU * C_SCALE * 1.41421356))
+/* c0 of the gentlest ramp, used until a command computes its own */
+#define C0_MIN_ACC   ((uint32_t)(16.0 * C0_K16 / sqrt(STEP_RAMP_MIN_ACC * ACC_SCALE)))
+
+/* AVR446 ramp of the master step rate, advanced by the compare ISR once per
+ * master step. c is the half-step period (an edge every c/64 CPU cycles);
+ * n is the ramp index, i.e. the number of steps it takes to reach the
+ * current rate from standstill at the current acceleration. Accelerating:
+ *     c' = c - 2c / (4n + 1),  n' = n + 1
+ * and braking runs the same recurrence backwards:
+ *     c' = c + 2c / (4n - 1),  n' = n - 1
+ * The remainder of each division is carried so the ramp does not drift.  */
+typedef struct {
+	/* shared with the ISR */
+	volatile uint32_t  c;          /* current half-step period, 0 = stopped         */
+	volatile uint32_t  c_target;   /* requested half-step period, 0 = stop          */
+	volatile uint32_t  c0;         /* first half-step from standstill               */
+	volatile uint32_t  n;          /* ramp index [steps]                            */
+	volatile uint32_t  rest;       /* division remainder carried between steps      */
+	volatile uint8_t   phase;      /* 1 while the pulses of this step are active    */
+	volatile uint8_t   band;       /* microstep band in effect                      */
+	volatile uint8_t   band_next;  /* band requested by the main loop               */
+	volatile uint8_t   inc;        /* finest microsteps per pulse in this band      */
+	volatile uint8_t   stop_req;   /* ISR brake in effect, see motors_brake_from_isr */
+	/* fast stop, prepared by the main loop for the ISR */
+	volatile uint32_t  stop_n;     /* ramp index to brake the commanded rate at stop_acc */
+	volatile uint8_t   stop_sh;    /* band shift stop_n is counted in               */
+	/* TOP dithering, ISR only */
+	uint16_t           top;        /* OCRnA for the current period                  */
+	uint16_t           frac;       /* fractional tick, 1/65536; 0 = no dithering    */
+	uint16_t           sd_acc;     /* sigma-delta accumulator                       */
+	/* main loop only */
+	uint32_t           last_rate;  /* master rate requested last tick, Q12          */
+	uint32_t           stop_acc;   /* fast-stop deceleration, Q8 finest microsteps/s^2 */
+	bool               reversing;  /* braking the master for a DIR change           */
+} StepRamp;
+
+/* One wheel's PUL/DIR pair. Every master step adds ratio to a Bresenham
+ * accumulator and the wheel steps on overflow, so all wheels share one time
+ * base and the commanded ratios between them hold however long the move is. */
+typedef struct {
+	volatile uint8_t  *pul_port;
+	volatile uint8_t  *dir_port;
+	uint8_t            pul_mask;
+	uint8_t            dir_mask;
+	bool               fwd_level;  /* DIR pin level that drives the wheel forward    */
+	bool               right;      /* right-hand side (odd axis)                    */
+	/* shared with the ISR */
+	volatile uint32_t  ratio;      /* wheel steps per master step, Q31              */
+	volatile bool      dir_target; /* DIR pin level requested                       */
+	volatile int32_t   steps;      /* emitted steps, + = wheel forward              */
+	bool               dir;        /* DIR pin level being driven                    */
+	uint32_t           acc;        /* Bresenham accumulator, Q31                    */
+	uint8_t            micro;      /* driver position mod STEP_MICRO_MAX            */
+	/* main loop only */
+	int32_t            rate;       /* requested step rate, Q12, + = forward         */
+} StepAxis;
+
+#define RATIO_ONE  0x80000000UL    /* Q31 1.0: the wheel steps on every master step */
+#define RATIO_REVERSE  ((uint32_t)(STEP_REVERSE_RATIO * 2147483648.0f)) /* Q31, see config */
+
+/* one row of STEP_AXES */
+typedef struct {
+	volatile uint8_t  *ddr;
+	volatile uint8_t  *port;
+	uint8_t            mask;
+} StepPin;
+
+typedef struct {
+	StepPin            pul;
+	StepPin            dir;
+	StepPin            ena;
+	bool               fwd_level;
+} StepAxisCfg;
+
+static const StepAxisCfg axis_cfg[] = STEP_AXES;
+#define AXIS_COUNT  (sizeof(axis_cfg) / sizeof(axis_cfg[0]))
+
+/* one microstep band, see STEP_BANDS */
+typedef struct {
+	uint8_t            micro;      /* microsteps per full step                      */
+	uint8_t            ms;         /* MS pin levels                                 */
+	float              max_mm_s;   /* top of the band, 0 = no limit                 */
+} StepBandCfg;
+
+#if STEP_MS_PINS
+static const StepBandCfg band_cfg[] = STEP_BANDS;
+#else
+static const StepBandCfg band_cfg[] = { { STEP_MICRO_MAX, 0, 0.0f } };
+#endif
+#define BAND_COUNT  (sizeof(band_cfg) / sizeof(band_cfg[0]))
+
+static const StepTimer master_timer = { &TCCR1B, &OCR1A, &OCR1B, &TCNT1 };
+
+/* log2 of the divisor for CSn2:0 = 1..5  (/1 /8 /64 /256 /1024) */
+static const uint8_t prescaler_shift[6] = { 0, 0, 3, 6, 8, 10 };
+
+/* ADC_SH_DELAY_CYCLES in timer ticks per CSn2:0, see step_adc_trigger() */
+static const uint16_t adc_sh_ticks[6] = {
+	0,
+	ADC_SH_DELAY_CYCLES,
+	ADC_SH_DELAY_CYCLES >> 3,
+	ADC_SH_DELAY_CYCLES >> 6,
+	ADC_SH_DELAY_CYCLES >> 8,
+	ADC_SH_DELAY_CYCLES >> 10,
+};
 
 /* private state ----------------------------------------------------------- */
-static uint16_t left_top;
-static uint16_t right_top;
+static StepRamp master = { .c0 = C0_MIN_ACC, .stop_acc = ACC_MIN_Q8 };
+static StepAxis axes[AXIS_COUNT];       /* pins filled from axis_cfg by motors_init() */
+
+/* filled from band_cfg by motors_init() */
+static uint8_t  band_shift[BAND_COUNT]; /* log2 of finest microsteps per pulse          */
+static uint32_t band_up[BAND_COUNT];    /* master rate (Q12) above which the next band is taken */
+static uint32_t band_down[BAND_COUNT];  /* ... below which the next band drops back to this one */
 
 /* helpers ----------------------------------------------------------------- */
-static inline uint32_t velocity_to_freq(uint16_t velocity)
+
+/* Finest prescaler whose TOP fits 16 bits; half_period (Q6 cycles) = 0 -> stopped.
+ * The period rarely is a whole number of timer ticks. If rounding it would
+ * be off by more than STEP_DITHER_PPM, the fraction is returned too. The ISR
+ * then alternates TOP and TOP+1 so the average period is exact.           */
+static StepTiming step_timing(uint32_t half_period)
 {
-	return ((uint32_t)velocity * STEPS_PER_REV * GEAR_RATIO) / (WHEEL_DIAMETER_MM * M_PI);
+	StepTiming t = { 0xFFFF, 0, 0 };
+	if (half_period == 0)
+		return t;
+
+	for (uint8_t cs = 1; cs <= 5; cs++)
+	{
+		uint8_t shift = prescaler_shift[cs];
+		uint32_t ticks = half_period >> shift; /* Q6 timer ticks */
+		if (ticks < (0x10000UL << STEP_C_FRAC_BITS) || cs == 5)
+		{
+			if (ticks >= (0x10000UL << STEP_C_FRAC_BITS))
+				ticks = (0x10000UL << STEP_C_FRAC_BITS) - 1;
+
+			uint16_t whole = (uint16_t)(ticks >> STEP_C_FRAC_BITS);
+			uint16_t frac = (uint16_t)((ticks & (C_SCALE - 1)) << (16 - STEP_C_FRAC_BITS));
+			uint16_t miss = (frac & 0x8000U) ? (uint16_t)(0U - frac) : frac;
+
+			/* rounding error in ppm = miss / 65536 / whole * 1e6 */
+			if (((uint32_t)miss * 15625UL >> 10) <= (uint32_t)STEP_DITHER_PPM * whole)
+			{
+				if (frac & 0x8000U)
+					whole++;
+				frac = 0;
+			}
+
+			t.top = (whole > 1) ? whole - 1 : 1;
+			t.frac = frac;
+			t.cs = cs;
+			break;
+		}
+	}
+	return t;
+}
+
+/* Compare B triggers the ADC, which holds its sample ADC_SH_DELAY_CYCLES
+   later: trigger that much before mid-period so the hold is half-way
+   between two edges. Below ~32 us per half step it cannot be: the trigger
+   is clamped to the edge and the hold follows 16 us later, past mid-period. */
+static inline uint16_t step_adc_trigger(StepTiming t)
+{
+	uint16_t half = t.top >> 1;
+	uint16_t d = adc_sh_ticks[t.cs];
+	return (half > d) ? half - d : 0;
+}
+
+/* Retime a running (or stopped) timer without cutting the current pulse short:
+ *  - a prescaler change rescales TCNT so the elapsed part of the pulse is kept,
+ *  - if the elapsed part is already longer than the new period the edge is
+ *    pulled in to the next timer clock instead of letting TCNT run past TOP
+ *    and wrap at 0xFFFF. It is not forced with FOCnA: a forced compare skips
+ *    the ISR, which has to see every edge to emit the steps.               */
+static void step_timer_apply(const StepTimer *tm, StepTiming t)
+{
+	uint8_t s = SREG;
+	cli();
+
+	uint8_t old_cs = *tm->tccrb & STEP_TIMER_CS_MASK;
+
+	if (t.cs == 0)
+	{
+		*tm->tccrb &= ~STEP_TIMER_CS_MASK;
+	}
+	else if (old_cs == 0)
+	{
+		*tm->ocra = t.top;
+		*tm->ocrb = step_adc_trigger(t);
+		*tm->tcnt = 0;
+		*tm->tccrb |= t.cs;
+	}
+	else
+	{
+		uint16_t tcnt = *tm->tcnt;
+
+		if (old_cs != t.cs)
+		{
+			uint32_t elapsed = (uint32_t)tcnt << prescaler_shift[old_cs];
+			elapsed >>= prescaler_shift[t.cs];
+			tcnt = (elapsed > 0xFFFFUL) ? 0xFFFF : (uint16_t)elapsed;
+			*tm->tccrb = (*tm->tccrb & ~STEP_TIMER_CS_MASK) | t.cs;
+			*tm->tcnt = tcnt;
+		}
+
+		*tm->ocra = t.top;
+		*tm->ocrb = step_adc_trigger(t);
+		if (tcnt >= t.top)
+			*tm->tcnt = t.top - 1; /* edge on the next timer clock, through the compare ISR */
+	}
+
+	SREG = s;
+}
+
+static inline void step_axis_dir_pin(StepAxis *a, bool level)
+{
+	(level ? (*a->dir_port |= a->dir_mask)
+		   : (*a->dir_port &= ~a->dir_mask));
+	a->dir = level;
+}
+
+/* Leading edge of a master step: PUL low if this wheel is due. A pulse moves
+ * the driver to the next point of its inc-microstep grid, which is inc finest
+ * microsteps unless a band change left it off the grid.                  */
+static inline void step_axis_pulse(StepAxis *a, uint8_t inc)
+{
+	uint32_t acc = a->acc + a->ratio;
+	if (acc >= RATIO_ONE)
+	{
+		acc -= RATIO_ONE;
+		*a->pul_port &= ~a->pul_mask;
+		uint8_t off = a->micro & (inc - 1);
+		if (a->dir == a->fwd_level)
+		{
+			uint8_t d = inc - off;
+			a->steps += d;
+			a->micro += d;
+		}
+		else
+		{
+			uint8_t d = off ? off : inc;
+			a->steps -= d;
+			a->micro -= d;
+		}
+	}
+	a->acc = acc;
+}
+
+/* trailing edge: PUL back high; a pending direction change goes out now,
+   half a master step ahead of the next pulse                          */
+static inline void step_axis_release(StepAxis *a)
+{
+	*a->pul_port |= a->pul_mask;
+	if (a->dir != a->dir_target)
+		step_axis_dir_pin(a, a->dir_target);
+}
+
+static StepTiming step_ramp_timing(uint32_t c)
+{
+	StepTiming t = step_timing(c);
+	master.top = t.top;
+	master.frac = t.frac;
+	return t;
+}
+
+static inline void step_axes_release(void)
+{
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+		step_axis_release(&axes[i]);
+}
+
+/* first master step from standstill; interrupts must be off */
+static void step_ramp_start(uint32_t c)
+{
+	step_axes_release();
+	master.c = c;
+	master.phase = 0;
+	step_timer_apply(&master_timer, step_ramp_timing(c));
+}
+
+/* jump straight to a master rate (no ramp); interrupts must be off */
+static void step_ramp_jump(uint32_t half_period)
+{
+	if (half_period > C_MAX)
+		half_period = C_MAX;
+	master.c_target = half_period;
+	master.n = 0;
+	master.rest = 0;
+
+	if (half_period == 0)
+	{
+		step_timer_apply(&master_timer, step_timing(0));
+		master.c = 0;
+		master.phase = 0;
+		step_axes_release();
+	}
+	else if (master.c == 0)
+	{
+		step_ramp_start(half_period);
+	}
+	else
+	{
+		master.c = half_period;
+		step_timer_apply(&master_timer, step_ramp_timing(half_period));
+	}
+}
+
+/* c << d without running past C_MAX */
+static inline uint32_t c_shift_up(uint32_t c, uint8_t d)
+{
+	return (c > (C_MAX >> d)) ? C_MAX : c << d;
+}
+
+/* Switch to the requested microstep band; interrupts off. The ramp is
+ * rescaled so the wheel speed does not change: c and the target grow with
+ * the pulse size, n shrinks. The two drivers rarely both sit on the coarser
+ * grid, so the switch does not wait for it: the indexer moves to the next
+ * valid state on the next pulse (DRV8825 rule) and step_axis_pulse()
+ * counts that shorter move.                                             */
+static void step_band_switch(void)
+{
+	uint8_t to = master.band_next;
+	uint8_t sh_from = band_shift[master.band];
+	uint8_t sh_to = band_shift[to];
+	uint32_t c = master.c, target = master.c_target, n = master.n;
+
+	if (sh_to > sh_from)
+	{
+		uint8_t d = sh_to - sh_from;
+		c = c_shift_up(c, d);
+		target = c_shift_up(target, d);
+		n = (n >> d) ? n >> d : (n ? 1 : 0);
+	}
+	else
+	{
+		uint8_t d = sh_from - sh_to;
+		c >>= d;
+		target >>= d;
+		n <<= d;
+	}
+
+#if STEP_MS_PINS
+	STEP_MS_PORT = (STEP_MS_PORT & ~STEP_MS_MASK) | band_cfg[to].ms;
+#endif
+	master.band = to;
+	master.inc = 1U << sh_to;
+	master.c_target = target;
+	master.n = n;
+	master.rest = 0;
+	if (c)
+	{
+		master.c = c;
+		step_timer_apply(&master_timer, step_ramp_timing(c));
+	}
+}
+
+/* band for master rate m (Q12), with hysteresis around the last request */
+static uint8_t step_band_pick(uint32_t m)
+{
+	uint8_t b = master.band_next;
+	while (b + 1 < BAND_COUNT && m > band_up[b])
+		b++;
+	while (b > 0 && m < band_down[b - 1])
+		b--;
+	return b;
+}
+
+/* half-step period of pulses that are 2^sh finest microsteps, for master
+   rate m (Q12 microsteps/s), rm = recip(m); 0 below STEP_RATE_MIN         */
+static inline uint32_t rate_to_half_period(uint32_t m, Recip rm, uint8_t sh)
+{
+	return (m >= RATE_MIN_Q12) ? recip_mul(F_CPU, rm, C_RATE_SHIFT + sh) : 0;
+}
+
+/* ramp index that brakes master rate m (Q12 finest microsteps/s) to a stop at
+   master.stop_acc, in pulses of band shift sh: n = w^2 / 2a              */
+static uint32_t step_stop_index(uint32_t m, uint8_t sh)
+{
+	uint32_t w = m >> (12 + sh); /* pulses/s */
+	if (w > 0xFFFFU)
+		w = 0xFFFFU;
+	return w ? recip_div(w * w, master.stop_acc >> sh, 7) : 0;
+}
+
+/* Ramp the master towards rate m (Q12, rm = recip(m)) at acc_q8 in band.
+ * Both are in finest microsteps; the ISR works in pulses of the band in
+ * effect.                                                               */
+static void step_ramp_command(uint32_t m, Recip rm, uint32_t acc_q8, uint8_t band)
+{
+	uint8_t s = SREG;
+	cli();
+	uint16_t t0 = irqmon_begin();
+	uint32_t c = master.c;
+	master.band_next = band;
+	if (c == 0)
+		step_band_switch(); /* stopped: change band now */
+	uint8_t sh = band_shift[master.band];
+	irqmon_end(IRQ_STEP_CMD, t0);
+	SREG = s;
+
+	uint32_t target = rate_to_half_period(m, rm, sh);
+	uint32_t acc = acc_q8 >> sh; /* pulses/s^2 */
+	uint32_t n = 0, c0 = 0;
+	uint32_t stop_n = step_stop_index(m, sh);
+	if (c)
+	{
+		/* ramp index of the rate the ISR is running now: n = w^2 / 2a */
+		uint32_t w = recip_div(F_CPU * C_SCALE / 2, c, 0); /* pulses/s */
+		if (w > 0xFFFFU)
+			w = 0xFFFFU;
+		n = recip_div(w * w, acc, 7);
+	}
+	else
+	{
+		c0 = recip_div(C0_K16, isqrt32(acc), 4);
+		if (c0 > C_MAX)
+			c0 = C_MAX;
+	}
+
+	cli();
+	t0 = irqmon_begin();
+	master.stop_n = stop_n;
+	master.stop_sh = sh;
+	uint8_t sh_now = band_shift[master.band];
+	if (master.stop_req)
+	{
+		/* braking for motors_brake_from_isr(): leave its ramp alone */
+	}
+	else if (sh_now == sh)
+	{
+		if (master.c)
+		{
+			master.n = n;
+			master.rest = 0;
+		}
+		if (c0)
+			master.c0 = c0;
+		master.c_target = target;
+	}
+	else /* the ISR changed band meanwhile */
+	{
+		master.c_target = (sh_now > sh) ? c_shift_up(target, sh_now - sh) : target >> (sh - sh_now);
+	}
+	if (master.c == 0 && master.c_target)
+	{
+		master.n = 0;
+		master.rest = 0;
+		step_ramp_start((master.c0 > master.c_target) ? master.c0 : master.c_target);
+	}
+	irqmon_end(IRQ_STEP_CMD, t0);
+	SREG = s;
+}
+
+static inline void step_ramp_reset(void)
+{
+	master.c = 0;
+	master.c_target = 0;
+	master.n = 0;
+	master.rest = 0;
+	master.phase = 0;
+	master.band_next = master.band;
+	master.stop_req = 0;
+	master.stop_n = 0;
+	master.last_rate = 0;
+	master.reversing = false;
+}
+
+/* Split signed wheel rates (Q12, + = forward) into the master rate (the
+ * fastest wheel) and per-wheel Bresenham ratios. Returns the master rate;
+ * *rm gets its reciprocal for the period conversion.
+ *
+ * With hold != NULL a DIR change never goes out at speed, where a
+ * closed-loop driver faults on it: if a wheel that is not near zero
+ * (RATIO_REVERSE) has to reverse while the master runs, the ratios and
+ * directions are left as they are, 0 is returned and *hold set, so the
+ * master brakes. Once it has stopped, the new directions are taken and
+ * step_ramp_start() puts them on the pins ahead of the first pulse.     */
+static uint32_t step_engine_split(const int32_t *rate, Recip *rm, bool *hold)
+{
+	uint32_t mag[AXIS_COUNT];
+	uint32_t m = 0;
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		mag[i] = (rate[i] < 0) ? -(uint32_t)rate[i] : (uint32_t)rate[i];
+		if (mag[i] > m)
+			m = mag[i];
+	}
+
+	*rm = recip(m);
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		uint32_t q = RATIO_ONE;
+		if (mag[i] < m)
+		{
+			q = recip_mul(mag[i], *rm, 31);
+			if (q > RATIO_ONE)
+				q = RATIO_ONE;
+		}
+		mag[i] = q;
+	}
+
+	uint8_t s = SREG;
+	cli();
+	if (hold)
+	{
+		*hold = false;
+		for (uint8_t i = 0; master.c && i < AXIS_COUNT; i++)
+		{
+			StepAxis *a = &axes[i];
+			bool level = (rate[i] >= 0) == a->fwd_level;
+			if (rate[i] != 0 && level != a->dir_target &&
+			    (a->ratio > RATIO_REVERSE || mag[i] > RATIO_REVERSE))
+				*hold = true;
+		}
+		if (*hold)
+		{
+			SREG = s;
+			*rm = recip(0);
+			return 0;
+		}
+	}
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		axes[i].ratio = mag[i];
+		if (rate[i] != 0 || !hold)
+			axes[i].dir_target = (rate[i] >= 0) == axes[i].fwd_level;
+	}
+	SREG = s;
+
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+		axes[i].rate = rate[i];
+	return m;
+}
+
+/* one master step done: advance the ramp; false once the clock has stopped */
+static bool step_ramp_advance(void)
+{
+	uint32_t c = master.c;
+	uint32_t n = master.n;
+	uint32_t target = master.c_target;
+	uint32_t num, den;
+
+	if (target == 0)
+	{
+		/* brake to standstill */
+		if (n <= 1)
+		{
+			*master_timer.tccrb &= ~STEP_TIMER_CS_MASK;
+			master.c = 0;
+			master.n = 0;
+			master.rest = 0;
+			return false;
+		}
+		num = 2UL * c + master.rest;
+		den = 4UL * n - 1;
+		c += num / den;
+		master.rest = num % den;
+		n--;
+	}
+	else if (c > target)
+	{
+		n++;
+		num = 2UL * c + master.rest;
+		den = 4UL * n + 1;
+		c -= num / den;
+		master.rest = num % den;
+		if (c < target)
+			c = target;
+	}
+	else if (c < target)
+	{
+		if (n > 1)
+		{
+			num = 2UL * c + master.rest;
+			den = 4UL * n - 1;
+			c += num / den;
+			master.rest = num % den;
+			n--;
+		}
+		if (c > target || n <= 1)
+			c = target;
+	}
+	else
+	{
+		return true; /* cruising */
+	}
+
+	if (c > C_MAX)
+		c = C_MAX;
+	master.c = c;
+	master.n = n;
+	step_timer_apply(&master_timer, step_ramp_timing(c));
+	return true;
+}
+
+/* Master clock: an edge every half step. The leading edge pulses the wheels
+   that are due, the trailing edge releases them and advances the ramp.    */
+ISR(TIMER1_COMPA_vect)
+{
+	uint16_t t0 = irqmon_begin();
+	bool retime = true;
+
+	if (master.phase == 0)
+	{
+		master.phase = 1;
+		uint8_t inc = master.inc;
+		for (uint8_t i = 0; i < AXIS_COUNT; i++)
+			step_axis_pulse(&axes[i], inc);
+	}
+	else
+	{
+		master.phase = 0;
+		step_axes_release();
+		if (master.band != master.band_next)
+			step_band_switch(); /* MS lines settle half a step before the next pulse */
+		retime = step_ramp_advance();
+	}
+
+	if (retime && master.frac)
+	{
+		uint16_t acc = master.sd_acc + master.frac;
+		OCR1A = master.top + (acc < master.sd_acc); /* carry out -> one tick longer */
+		master.sd_acc = acc;
+	}
+
+	irqmon_end(IRQ_STEP_ISR, t0);
+}
+
+/* Wheel rates (Q12 microsteps/s, + = forward) for the body command: vx
+   forward and vy to the left [mm/s], omega counter-clockwise [deg/s].   */
+static void drive_kinematics(float vx, float vy, float omega, int32_t *rate)
+{
+	/* the unit conversions fold into constants: one multiply per term */
+	int32_t forward = (int32_t)(vx * MM_TO_Q12);
+	int32_t turn    = (int32_t)(omega * DPS_TO_Q12);
+
+#if DRIVE_KINEMATICS == DRIVE_DIFF
+	(void)vy;
+	rate[0] = forward - turn;
+	rate[1] = forward + turn;
+#elif DRIVE_KINEMATICS == DRIVE_SKID
+	(void)vy;
+	rate[0] = rate[2] = forward - turn;
+	rate[1] = rate[3] = forward + turn;
+#elif DRIVE_KINEMATICS == DRIVE_MECANUM
+	int32_t side = (int32_t)(vy * MM_TO_Q12);
+	rate[0] = forward - side - turn;   /* front-left  */
+	rate[1] = forward + side + turn;   /* front-right */
+	rate[2] = forward + side - turn;   /* rear-left   */
+	rate[3] = forward - side + turn;   /* rear-right  */
+#else
+#error "DRIVE_KINEMATICS: DRIVE_DIFF, DRIVE_SKID or DRIVE_MECANUM"
+#endif
 }
 
 /* public functions -------------------------------------------------------- */
 void motors_init(void)
 {
-	/* I/O direction ------------------------------------------------------- */
-	LEFT_PUL_DDR |= _BV(LEFT_PUL_BIT);
-	LEFT_DIR_DDR |= _BV(LEFT_DIR_BIT);
-	LEFT_ENA_DDR |= _BV(LEFT_ENA_BIT);
+	/* I/O direction and default levels: pulses high, forward, drivers
+	   disabled. Shared ENA pins are simply set twice.                    */
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		const StepAxisCfg *cfg = &axis_cfg[i];
+		StepAxis *a = &axes[i];
 
-	RIGHT_PUL_DDR |= _BV(RIGHT_PUL_BIT);
-	RIGHT_DIR_DDR |= _BV(RIGHT_DIR_BIT);
-	RIGHT_ENA_DDR |= _BV(RIGHT_ENA_BIT);
+		*cfg->pul.ddr |= cfg->pul.mask;
+		*cfg->dir.ddr |= cfg->dir.mask;
+		*cfg->ena.ddr |= cfg->ena.mask;
+		*cfg->pul.port |= cfg->pul.mask;
+		*cfg->dir.port |= cfg->dir.mask;
+		*cfg->ena.port &= ~cfg->ena.mask;
 
-	/* default levels � pulses high, forward, drivers disabled ------------ */
-	LEFT_PUL_PORT |= _BV(LEFT_PUL_BIT);
-	LEFT_DIR_PORT |= _BV(LEFT_DIR_BIT);
-	LEFT_ENA_PORT &= ~_BV(LEFT_ENA_BIT);
+		a->pul_port = cfg->pul.port;
+		a->dir_port = cfg->dir.port;
+		a->pul_mask = cfg->pul.mask;
+		a->dir_mask = cfg->dir.mask;
+		a->fwd_level = cfg->fwd_level;
+		a->right = i & 1;
+		a->dir = a->dir_target = true;
+	}
 
-	RIGHT_PUL_PORT |= _BV(RIGHT_PUL_BIT);
-	RIGHT_DIR_PORT |= _BV(RIGHT_DIR_BIT);
-	RIGHT_ENA_PORT &= ~_BV(RIGHT_ENA_BIT);
+	/* microstep bands: pulse sizes and speed limits, finest band selected */
+	for (uint8_t i = 0; i < BAND_COUNT; i++)
+	{
+		uint8_t sh = 0;
+		while (((unsigned)band_cfg[i].micro << sh) < STEP_MICRO_MAX)
+			sh++;
+		band_shift[i] = sh;
+		band_up[i] = (band_cfg[i].max_mm_s > 0.0f) ? (uint32_t)(band_cfg[i].max_mm_s * MM_TO_Q12) : UINT32_MAX;
+		band_down[i] = (band_cfg[i].max_mm_s > 0.0f) ? (uint32_t)(band_cfg[i].max_mm_s * (1.0f - STEP_BAND_HYST) * MM_TO_Q12) : UINT32_MAX;
+	}
+	master.band = master.band_next = 0;
+	master.inc = 1U << band_shift[0];
+#if STEP_MS_PINS
+	STEP_MS_DDR |= STEP_MS_MASK;
+	STEP_MS_PORT = (STEP_MS_PORT & ~STEP_MS_MASK) | band_cfg[0].ms;
+#endif
 
-	/* — Timer-3 (16-bit) drives LEFT motor PUL on OC3A (PC6/D5) — */
-	TCCR3A = _BV(COM3A0); /* toggle OC3A on compare match          */
-	TCCR3B = _BV(WGM32);  /* CTC mode (TOP = OCR3A), clk stopped   */
+	/* — Timer-1 (16-bit) is the master step clock for all wheels —
+	   PUL pins are driven from its compare-A ISR; compare B (no ISR) sits
+	   half-way between two edges and triggers the ADC, see analog.c        */
+	TCCR1A = 0;           /* OC1A disconnected, pins are plain outputs */
+	TCCR1B = _BV(WGM12);  /* CTC mode (TOP = OCR1A), clk stopped       */
+	TIMSK1 = _BV(OCIE1A);
 
-	/* — Timer-1 (16-bit) drives RIGHT motor PUL on OC1A (PB5/D9) — */
-	TCCR1A = _BV(COM1A0); /* toggle OC1A on compare match          */
-	TCCR1B = _BV(WGM12);  /* CTC mode, clk stopped                 */
-	
 	motors_enable_all(true);
 }
 
-void motors_enable_left(bool en)
+static void motors_enable_side(bool right, bool en)
 {
-	(en ? (LEFT_ENA_PORT |= _BV(LEFT_ENA_BIT))
-		: (LEFT_ENA_PORT &= ~_BV(LEFT_ENA_BIT)));
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		const StepPin *ena = &axis_cfg[i].ena;
+		if (axes[i].right == right)
+			(en ? (*ena->port |= ena->mask)
+				: (*ena->port &= ~ena->mask));
+	}
 }
 
-void motors_enable_right(bool en)
-{
-	(en ? (RIGHT_ENA_PORT |= _BV(RIGHT_ENA_BIT))
-		: (RIGHT_ENA_PORT &= ~_BV(RIGHT_ENA_BIT)));
-}
+void motors_enable_left(bool en)  { motors_enable_side(false, en); }
+void motors_enable_right(bool en) { motors_enable_side(true, en); }
 
 void motors_enable_all(bool en)
 {
@@ -72,76 +787,207 @@ void motors_enable_all(bool en)
 	motors_enable_right(en);
 }
 
-void motors_set_dir_left(bool fwd)
+static void motors_set_dir_side(bool right, bool fwd)
 {
-	(fwd ? (LEFT_DIR_PORT |= _BV(LEFT_DIR_BIT))
-		 : (LEFT_DIR_PORT &= ~_BV(LEFT_DIR_BIT)));
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		StepAxis *a = &axes[i];
+		if (a->right != right)
+			continue;
+
+		uint8_t s = SREG;
+		cli();
+		step_axis_dir_pin(a, fwd);
+		a->dir_target = fwd;
+		SREG = s;
+		if ((fwd == a->fwd_level) != (a->rate >= 0))
+			a->rate = -a->rate;
+	}
 }
 
-void motors_set_dir_right(bool fwd)
+/* fwd is the DIR pin level, as before: each axis' fwd_level decides what it means */
+void motors_set_dir_left(bool fwd)  { motors_set_dir_side(false, fwd); }
+void motors_set_dir_right(bool fwd) { motors_set_dir_side(true, fwd); }
+
+/* The motors_set_speed_* calls retime immediately without a ramp, keeping
+   the direction set by motors_set_dir_*; the ramped path is motors_update(). */
+static void motors_set_rates_now(const int32_t *rate)
 {
-	(fwd ? (RIGHT_DIR_PORT |= _BV(RIGHT_DIR_BIT))
-		 : (RIGHT_DIR_PORT &= ~_BV(RIGHT_DIR_BIT)));
+	Recip rm;
+	uint32_t m = step_engine_split(rate, &rm, NULL);
+	master.last_rate = m;
+	uint8_t band = step_band_pick(m);
+	uint32_t stop_n = step_stop_index(m, band_shift[band]);
+
+	uint8_t s = SREG;
+	cli();
+	uint16_t t0 = irqmon_begin();
+	master.stop_n = stop_n;
+	master.stop_sh = band_shift[band];
+	master.band_next = band;
+	if (master.c == 0)
+		step_band_switch();
+	if (!master.stop_req)
+		step_ramp_jump(rate_to_half_period(m, rm, band_shift[master.band]));
+	irqmon_end(IRQ_STEP_CMD, t0);
+	SREG = s;
 }
 
-void motors_set_speed_left(uint16_t vel)
+static inline int32_t signed_rate(const StepAxis *a, uint16_t vel)
 {
-	uint32_t freq = velocity_to_freq(vel);
-	uint32_t top = (F_CPU / (2UL * freq * CLOCK_DIVISOR_TIMER3)) - 1UL;
-	if (top > 0xFFFF)
-		top = 0xFFFF; /* clamp to 16-bit */
+	int32_t rate = (int32_t)(vel * MM_TO_Q12);
+	return (a->dir_target == a->fwd_level) ? rate : -rate;
+}
 
-	left_top = (uint16_t)top;
-	OCR3A = left_top;
+/* vel [mm/s] per side; UINT16_MAX keeps a side's current rate */
+static void motors_set_speed_sides(uint16_t vel_left, uint16_t vel_right)
+{
+	int32_t rate[AXIS_COUNT];
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		uint16_t vel = axes[i].right ? vel_right : vel_left;
+		rate[i] = (vel == UINT16_MAX) ? axes[i].rate : signed_rate(&axes[i], vel);
+	}
+	motors_set_rates_now(rate);
+}
 
-	/* start Timer-3 with /1024 prescale */
-	TCCR3B &= ~(_BV(CS32) | _BV(CS31) | _BV(CS30)); /* clear first   */
-	TCNT3 = 0;
-	TCCR3B |= PRE_SCALE_TIMER3;
+void motors_set_speed_left(uint16_t vel)
+{
+	motors_set_speed_sides(vel, UINT16_MAX);
 }
 
 void motors_set_speed_right(uint16_t vel)
 {
-	uint32_t freq = velocity_to_freq(vel);
-	uint32_t top = (F_CPU / (2UL * freq * CLOCK_DIVISOR_TIMER1)) - 1UL;
-
-	right_top = (uint16_t)top;
-	OCR1A = right_top;
-
-	/* start Timer-1 with /1024 pre-scale */
-	TCCR1B &= ~(_BV(CS12) | _BV(CS11) | _BV(CS10)); /* clear first   */
-	TCNT1 = 0;
-	TCCR1B |= PRE_SCALE_TIMER1;
+	motors_set_speed_sides(UINT16_MAX, vel);
 }
 
 void motors_set_speed_both(uint16_t vel_left, uint16_t vel_right)
 {
-	motors_set_speed_left(vel_left);
-	motors_set_speed_right(vel_right);
+	motors_set_speed_sides(vel_left, vel_right);
 }
 
 void motors_update( float velocity, float omega)
 {
-	/* Feed-forward terms based on desired wheel tangential speed */
-	float tangent_speed = omega * WHEEL_BASE_MM * M_PI/ 360.0 ;
-	float left_speed    = velocity - tangent_speed;
-	float right_speed   = velocity + tangent_speed;
+	motors_update_holonomic(velocity, 0.0f, omega);
+}
+
+void motors_update_holonomic(float vx, float vy, float omega)
+{
+	PROF_BEGIN(PROF_MOTORS);
+
+	int32_t rate[AXIS_COUNT];
+	drive_kinematics(vx, vy, omega, rate);
+
+	// All wheels run off the master clock; the master follows the fastest wheel
+	Recip rm;
+	bool hold;
+	uint32_t m = step_engine_split(rate, &rm, &hold);
+
+	// A reversal brakes at the rate it was asked from, ramps up from standstill
+	if (master.reversing && !hold)
+		master.last_rate = 0;
+	master.reversing = hold;
+
+	// Ramp acceleration: reach this tick's rate in exactly one tick
+	uint32_t dm = (m > master.last_rate) ? m - master.last_rate : master.last_rate - m;
+	dm >>= RATE_ACC_SH;
+	if (dm > UINT32_MAX / (1000U / LOOP_TIME))
+		dm = UINT32_MAX / (1000U / LOOP_TIME);
+	uint32_t acc = dm * (1000U / LOOP_TIME);
+	if (acc < ACC_MIN_Q8)
+		acc = ACC_MIN_Q8;
+	if (!hold)
+		master.last_rate = m;
+
+	step_ramp_command(m, rm, acc, step_band_pick(m));
+
+	PROF_END(PROF_MOTORS);
+}
+
+/* Controlled stop: all wheels ramp down to standstill at acc [mm/s^2]
+   with the drivers left enabled.                                      */
+void motors_brake(float acc)
+{
+	uint32_t acc_q8 = (uint32_t)(acc * MM_TO_ACC_Q8);
+	if (acc_q8 < ACC_MIN_Q8)
+		acc_q8 = ACC_MIN_Q8;
 
-	// Get absolute speeds for motor control
-	float left_abs = fabsf(left_speed);
-	float right_abs = fabsf(right_speed);
-	
-	// Set directions based on speed signs
-	motors_set_dir_left(left_speed >= 0);
-	motors_set_dir_right(right_speed < 0); //invert due opposite orientation
-	
-	motors_set_speed_both((uint16_t)left_abs, (uint16_t)right_abs);
+	master.last_rate = 0;
+	master.stop_req = 0; /* this brake takes over from an ISR one */
+	step_ramp_command(0, recip(0), acc_q8, master.band_next);
+}
+
+void motors_set_fast_stop(float acc)
+{
+	uint32_t acc_q8 = (uint32_t)(acc * MM_TO_ACC_Q8);
+	master.stop_acc = (acc_q8 < ACC_MIN_Q8) ? ACC_MIN_Q8 : acc_q8;
+}
+
+/* Interrupts off (an ISR). Only stores: the ramp index for the fast-stop
+ * deceleration was worked out by the last command, so there is no maths
+ * here. stop_req keeps motors_update() from overwriting the brake until the
+ * main loop calls motors_brake() or motors_stop_all().                    */
+void motors_brake_from_isr(void)
+{
+	master.stop_req = 1;
+	master.c_target = 0;
+	if (master.c && master.stop_n)
+	{
+		uint8_t sh = band_shift[master.band];
+		uint32_t n = master.stop_n;
+		n = (sh > master.stop_sh) ? n >> (sh - master.stop_sh) : n << (master.stop_sh - sh);
+		master.n = n ? n : 1;
+		master.rest = 0;
+	}
+}
+
+int32_t motors_get_steps(uint8_t axis)
+{
+	if (axis >= AXIS_COUNT)
+		return 0;
+
+	uint8_t s = SREG;
+	cli();
+	int32_t n = axes[axis].steps;
+	SREG = s;
+	return n;
+}
+
+int32_t motors_get_steps_left(void)  { return motors_get_steps(0); }
+int32_t motors_get_steps_right(void) { return motors_get_steps(1); }
+
+/* axes 0 and 1 (the encoder wheels) */
+void motors_set_steps(int32_t left, int32_t right)
+{
+	uint8_t s = SREG;
+	cli();
+	axes[0].steps = left;
+	axes[1].steps = right;
+	SREG = s;
+}
+
+void motors_reset_steps(void)
+{
+	uint8_t s = SREG;
+	cli();
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+		axes[i].steps = 0;
+	SREG = s;
 }
 
 void motors_stop_all()
 {
 	motors_enable_all(false);
 
+	uint8_t s = SREG;
+	cli();
 	TCCR1B &= ~(_BV(CS12) | _BV(CS11) | _BV(CS10)); /* stop Timer-1 */
-	TCCR3B &= ~(_BV(CS32) | _BV(CS31) | _BV(CS30)); /* stop Timer-3 */
-}
\ No newline at end of file
+	step_ramp_reset();
+	step_axes_release();
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		axes[i].acc = 0;
+		axes[i].rate = 0;
+	}
+	SREG = s;
+}
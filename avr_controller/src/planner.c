@@ -0,0 +1,162 @@
+/* -----------------------------------------------------------------------------
+ * planner.c  Lookahead junction-speed planner for segment batches
+ *
+ * Junction speeds are the largest values that respect
+ *   - both neighbouring segments' max_vel,
+ *   - a full stop before/after turns and direction reversals,
+ *   - v_exit^2 <= v_entry^2 + 2*a*d  forwards and backwards through the batch.
+ * Each segment then runs as an ordinary forward/rotation profile ending at
+ * its junction speed; the next one is chained on PE_MOTION_COMPLETE with only
+ * a soft reset, so the robot does not stop in between.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include "config.h"
+#include <stdbool.h>
+#include <math.h>
+#include "profiler.h"
+#include "planner.h"
+
+static Segment segs[PLANNER_MAX_SEGMENTS];
+static uint8_t seg_count = 0;
+static uint8_t seg_cursor = 0;
+static bool    running = false;
+static float   run_length = 0.0f; /* |distance| handed to the running forward profile */
+
+/* ====================  helpers =================== */
+static inline bool is_straight(const Segment *s)
+{
+	return s->distance != 0.0f && s->angle == 0.0f;
+}
+
+/* can the robot roll from a into b without stopping? */
+static bool can_blend(const Segment *a, const Segment *b)
+{
+	return is_straight(a) && is_straight(b) && ((a->distance < 0.0f) == (b->distance < 0.0f));
+}
+
+static inline float reachable(float v_from, float acc, float dist)
+{
+	return sqrtf(v_from * v_from + 2.0f * acc * fabsf(dist));
+}
+
+/* carry: distance already covered by the previous segment's overshoot */
+static void start_segment(const Segment *s, float carry)
+{
+	if (s->distance != 0.0f)
+	{
+		float d = (s->distance < 0.0f) ? s->distance + carry : s->distance - carry;
+		run_length = fabsf(d);
+		motion_start_move(d, s->max_vel, s->exit_vel, s->lin_acc);
+	}
+	if (s->angle != 0.0f)
+		motion_start_turn(s->angle, s->max_omega, 0, s->ang_acc);
+}
+
+/* ====================  API =================== */
+void planner_clear(void)
+{
+	seg_count = 0;
+	seg_cursor = 0;
+	running = false;
+}
+
+bool planner_add(const Segment *s)
+{
+	if (seg_count >= PLANNER_MAX_SEGMENTS || running)
+		return false;
+
+	segs[seg_count] = *s;
+	segs[seg_count].exit_vel = 0.0f;
+	seg_count++;
+	return true;
+}
+
+uint8_t planner_count(void) { return seg_count; }
+const Segment *planner_segment(uint8_t i) { return &segs[i]; }
+bool planner_active(void) { return running; }
+
+float planner_plan(void)
+{
+	if (seg_count == 0)
+		return 0.0f;
+
+	/* upper bound: speed limits of both sides, zero where blending is impossible */
+	for (uint8_t i = 0; i + 1 < seg_count; i++)
+	{
+		Segment *a = &segs[i];
+		const Segment *b = &segs[i + 1];
+		a->exit_vel = can_blend(a, b) ? fminf(a->max_vel, b->max_vel) : 0.0f;
+	}
+	segs[seg_count - 1].exit_vel = 0.0f;
+
+	/* backward pass: must be able to brake down to the next junction */
+	for (int8_t i = seg_count - 2; i >= 0; i--)
+	{
+		const Segment *b = &segs[i + 1];
+		segs[i].exit_vel = fminf(segs[i].exit_vel, reachable(b->exit_vel, b->lin_acc, b->distance));
+	}
+
+	/* forward pass: must be able to accelerate up to it from standstill */
+	float v_in = 0.0f;
+	for (uint8_t i = 0; i < seg_count; i++)
+	{
+		Segment *s = &segs[i];
+		s->exit_vel = fminf(s->exit_vel, reachable(v_in, s->lin_acc, s->distance));
+		v_in = s->exit_vel;
+	}
+
+	/* predicted batch time, using the same closed form as profile_start() */
+	float total = 0.0f;
+	v_in = 0.0f;
+	for (uint8_t i = 0; i < seg_count; i++)
+	{
+		const Segment *s = &segs[i];
+		ProfilePlan fwd = {0}, rot = {0};
+
+		if (s->distance != 0.0f)
+			profile_plan(&fwd, fabsf(s->distance), v_in, s->max_vel, s->exit_vel, s->lin_acc);
+		if (s->angle != 0.0f)
+			profile_plan(&rot, fabsf(s->angle), 0.0f, s->max_omega, 0.0f, s->ang_acc);
+
+		total += fmaxf(fwd.total_time, rot.total_time);
+		v_in = s->exit_vel;
+	}
+	return total;
+}
+
+bool planner_start(void)
+{
+	if (seg_count == 0)
+		return false;
+
+	seg_cursor = 0;
+	running = true;
+	start_segment(&segs[0], 0.0f);
+	return true;
+}
+
+bool planner_next(void)
+{
+	if (!running)
+		return false;
+
+	/* the finishing tick overshoots by up to v*dt; take it off the next segment */
+	const Segment *done = &segs[seg_cursor];
+	float carry = (done->distance != 0.0f) ? fabsf(motion_position()) - run_length : 0.0f;
+
+	if (++seg_cursor >= seg_count)
+	{
+		planner_clear(); /* a batch runs once: the next SEG starts a new one */
+		return false;
+	}
+
+	const Segment *s = &segs[seg_cursor];
+	if (carry < 0.0f || !can_blend(done, s) || carry >= fabsf(s->distance))
+		carry = 0.0f;
+
+	motion_SOFT_reset_drive_system();
+	start_segment(s, carry);
+	return true;
+}
@@ -0,0 +1,58 @@
+/* -----------------------------------------------------------------------------
+ * prof.c  Hot-path probe statistics
+ *
+ * The probes themselves are inline (prof.h) so an ISR probe adds no call and
+ * no extra register saves. This file only holds the table and formats it
+ * for the PROF service command.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <util/atomic.h>
+#include "prof.h"
+
+ProfStat prof_stats[PROF_COUNT] = { [0 ... PROF_COUNT - 1] = { .min = 0xFFFF } };
+
+static const char *const prof_names[PROF_COUNT] = {
+	[PROF_ENC_L]     = "ENC_L",
+	[PROF_ENC_R]     = "ENC_R",
+	[PROF_MOTION]    = "MOTION",
+	[PROF_MOTORS]    = "MOTORS",
+	[PROF_IMU]       = "IMU",
+	[PROF_ADC]       = "ADC",
+	[PROF_TELEMETRY] = "TELEM",
+};
+
+/* ticks are 0.5 us: print as us with one decimal */
+#define US_INT(t)   ((unsigned long)((t) >> 1))
+#define US_DEC(t)   ((unsigned)((t) & 1U) * 5U)
+
+int prof_format(uint8_t id, char *buf, size_t n, bool reset)
+{
+	ProfStat s;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		s = prof_stats[id];
+		if (reset)
+			prof_stats[id] = (ProfStat){ .min = 0xFFFF };
+	}
+
+	if (s.count == 0)
+		return snprintf(buf, n, "PROF %s n=0\r\n", prof_names[id]);
+
+	uint32_t avg = (s.sum + s.count / 2) / s.count;
+
+	return snprintf(buf, n, "PROF %s n=%lu min=%lu.%u avg=%lu.%u max=%lu.%u us\r\n",
+					prof_names[id], (unsigned long)s.count,
+					US_INT(s.min), US_DEC(s.min),
+					US_INT(avg),   US_DEC(avg),
+					US_INT(s.max), US_DEC(s.max));
+}
+
+const char *prof_name(uint8_t id)
+{
+	return (id < PROF_COUNT) ? prof_names[id] : "?";
+}
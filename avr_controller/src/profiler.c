@@ -8,12 +8,12 @@
 
 #include "config.h"
 #include <avr/io.h>
-#include <util/delay.h>
 #include <stdbool.h>
 #include <math.h>
 #include "motors.h"
 #include "encoder.h"
 #include "profiler.h"
+#include "prof.h"
 
 /* ====================  helpers =================== */
 static inline float enc_loop_time_s(void)
@@ -26,9 +26,112 @@ static inline float feedback_speed(ProfileKind k)
 	return (k == PK_FORWARD) ? encoder_robot_speed_mm_s() : encoder_robot_omega_dps();
 }
 
+static inline float measured_position(ProfileKind k)
+{
+	return (k == PK_FORWARD) ? encoder_robot_distance_mm() : encoder_robot_angle_deg();
+}
+
+static bool settle_enabled = SETTLE_ENABLED;
+
+/* derating on top of the commanded limits (slope, battery ...), see motion_set_limit_scale() */
+static float limit_acc_scale = 1.0f;
+static float limit_inv_acc_scale = 1.0f;
+static float limit_speed_scale = 1.0f;
+
 static float profile_braking_distance(const Profile *p)
 {
-	return fabsf(p->speed * p->speed - p->final_speed * p->final_speed) * 0.5f * p->one_over_acc;
+	return fabsf(p->speed * p->speed - p->final_speed * p->final_speed) * 0.5f * p->one_over_acc * limit_inv_acc_scale;
+}
+
+/* phase durations for a start speed v0, top speed vt and final speed vf (all magnitudes) */
+void profile_plan(ProfilePlan *pl, float distance, float v0, float vt, float vf, float acc)
+{
+	*pl = (ProfilePlan){0};
+
+	if (acc < 1.0f || vt <= 0.0f)
+		return; /* never gets there: feasible = false, total_time = 0 */
+
+	const float half_over_acc = 0.5f / acc;
+	float d_acc = fabsf(vt * vt - v0 * v0) * half_over_acc;
+	float d_brk = (vt * vt - vf * vf) * half_over_acc;
+
+	pl->feasible = true;
+
+	if (d_acc + d_brk <= distance)
+	{
+		pl->peak_speed = vt;
+		pl->cruise_time = (distance - d_acc - d_brk) / vt;
+	}
+	else
+	{
+		/* triangular: accelerate to v_peak, then brake straight to vf */
+		float vp2 = acc * distance + 0.5f * (v0 * v0 + vf * vf);
+		pl->triangular = true;
+
+		if (vp2 < v0 * v0)
+		{
+			/* even braking from the first tick overshoots vf */
+			vp2 = v0 * v0;
+			vf = sqrtf(v0 * v0 - 2.0f * acc * distance);
+			pl->feasible = false;
+		}
+		else if (vp2 < vf * vf)
+		{
+			/* too short to even reach vf */
+			vp2 = vf * vf;
+			vf = sqrtf(v0 * v0 + 2.0f * acc * distance);
+			pl->feasible = false;
+		}
+		pl->peak_speed = sqrtf(vp2);
+	}
+
+	pl->accel_time = fabsf(pl->peak_speed - v0) / acc;
+	pl->brake_time = fabsf(pl->peak_speed - vf) / acc;
+	pl->total_time = pl->accel_time + pl->cruise_time + pl->brake_time;
+}
+
+static void profile_finish(Profile *p)
+{
+	p->state = PS_FINISHED;
+	p->target_speed = p->final_speed;
+	p->settle_error = p->sign * p->final_position - measured_position(p->kind);
+}
+
+/* creep onto the target using the encoder position, not the integrated speed */
+static void profile_settle(Profile *p, float dt)
+{
+	const bool fwd = (p->kind == PK_FORWARD);
+	const float tol = fwd ? SETTLE_TOL_MM : SETTLE_TOL_DEG;
+	const float creep = fwd ? SETTLE_CREEP_MM_S : SETTLE_CREEP_DPS;
+	const float still = fwd ? SETTLE_STILL_MM_S : SETTLE_STILL_DPS;
+
+	float error = p->sign * p->final_position - measured_position(p->kind);
+	p->settle_time += dt;
+
+	if (fabsf(error) <= tol)
+	{
+		p->speed = 0.0f;
+		if (fabsf(feedback_speed(p->kind)) <= still)
+			p->settle_hold++;
+		else
+			p->settle_hold = 0;
+	}
+	else
+	{
+		float v = SETTLE_GAIN * error;
+		if (v > creep)
+			v = creep;
+		else if (v < -creep)
+			v = -creep;
+		p->speed = v;
+		p->settle_hold = 0;
+	}
+
+	if (p->settle_hold >= SETTLE_HOLD_TICKS || p->settle_time >= SETTLE_TIMEOUT_S)
+	{
+		p->speed = 0.0f;
+		profile_finish(p);
+	}
 }
 
 /* ====================  Profile API =================== */
@@ -39,6 +142,11 @@ void profile_reset(Profile *p)
 	p->speed = 0.0f;
 	p->target_speed = 0.0f;
 	p->state = PS_IDLE;
+	p->last_state = PS_IDLE;
+	p->watch_armed = false;
+	p->plan = (ProfilePlan){ .feasible = true }; /* idle: nothing to reach, zero times */
+	p->settle_error = 0.0f;
+	p->settle_time = 0.0f;
 	sei();
 }
 
@@ -48,8 +156,11 @@ void profile_start(Profile *p, float distance, float top_speed, float final_spee
 	if (distance < 0.0f)
 		distance = -distance;
 
+	p->last_state = PS_IDLE; /* a restart always reports its phases */
+
 	if (distance < 1.0f)
 	{
+		p->plan = (ProfilePlan){ .feasible = true };
 		p->state = PS_FINISHED;
 		return;
 	}
@@ -57,6 +168,8 @@ void profile_start(Profile *p, float distance, float top_speed, float final_spee
 	if (final_speed > top_speed)
 		final_speed = top_speed;
 
+	profile_plan(&p->plan, distance, fabsf(p->speed), fabsf(top_speed), fabsf(final_speed), fabsf(acceleration));
+
 	p->position = 0.0f;
 	p->final_position = distance;
 
@@ -66,6 +179,10 @@ void profile_start(Profile *p, float distance, float top_speed, float final_spee
 	p->acceleration = fabsf(acceleration);
 	p->one_over_acc = (p->acceleration >= 1.0f) ? (1.0f / p->acceleration) : 1.0f;
 
+	p->settle_error = 0.0f;
+	p->settle_time = 0.0f;
+	p->settle_hold = 0;
+
 	p->state = PS_ACCELERATING;
 }
 
@@ -84,10 +201,18 @@ void profile_update(Profile *p)
 		return;
 
 	float dt = enc_loop_time_s();
-	float delta_v = p->acceleration * dt;
+
+	if (p->state == PS_SETTLING)
+	{
+		profile_settle(p, dt);
+		p->position += feedback_speed(p->kind) * dt;
+		return;
+	}
+
+	float delta_v = p->acceleration * limit_acc_scale * dt;
 	float remaining = fabsf(p->final_position) - fabsf(p->position);
 
-	if (p->state == PS_ACCELERATING)
+	if (p->state == PS_ACCELERATING || p->state == PS_CRUISING)
 	{
 		if (remaining < profile_braking_distance(p))
 		{
@@ -97,27 +222,43 @@ void profile_update(Profile *p)
 	}
 
 	/* reach target speed */
-	if (p->speed < p->target_speed)
+	float target = p->target_speed * limit_speed_scale;
+	if (p->speed < target)
 	{
 		p->speed += delta_v;
-		if (p->speed > p->target_speed)
-			p->speed = p->target_speed;
+		if (p->speed > target)
+			p->speed = target;
 	}
-	else if (p->speed > p->target_speed)
+	else if (p->speed > target)
 	{
 		p->speed -= delta_v;
-		if (p->speed < p->target_speed)
-			p->speed = p->target_speed;
+		if (p->speed < target)
+			p->speed = target;
 	}
 
+	if (p->state == PS_ACCELERATING && p->speed == target)
+		p->state = PS_CRUISING;
+
 	/* integrate position with feedback */
 	float fb_speed = feedback_speed(p->kind);
 	p->position += fb_speed * dt;
 
-	if (p->state != PS_FINISHED && remaining < 0.125f)
+	/* a stop-at-end ramp may run out of speed short of the target: settle from there */
+	bool ramp_done = (p->state == PS_BRAKING && p->speed == target);
+	bool settle = settle_enabled && p->final_speed == 0.0f;
+
+	if (p->state != PS_FINISHED && (remaining < 0.125f || (settle && ramp_done)))
 	{
-		p->state = PS_FINISHED;
-		p->target_speed = p->final_speed;
+		if (settle)
+		{
+			p->state = PS_SETTLING;
+			p->settle_time = 0.0f;
+			p->settle_hold = 0;
+		}
+		else
+		{
+			profile_finish(p);
+		}
 	}
 }
 
@@ -126,16 +267,78 @@ void profile_update(Profile *p)
 /* ====================  Motion aggregate =================== */
 MotionType motionType; /* single instance */
 
+static ProfileEventHandler event_handler = 0;
+static bool motion_busy = false; /* a move/turn was started and has not completed */
+static bool drivers_released = true; /* motion_stop() disabled the drivers */
+
+static inline void motion_emit(ProfileEvent ev, const Profile *p)
+{
+	if (event_handler)
+		event_handler(ev, p);
+}
+
+static inline bool profile_done(const Profile *p)
+{
+	return p->state == PS_IDLE || p->state == PS_FINISHED;
+}
+
+/* report phase changes and position thresholds seen since the last call */
+static void profile_dispatch(Profile *p)
+{
+	if (p->state != p->last_state)
+	{
+		p->last_state = p->state;
+		motion_emit((p->state == PS_FINISHED) ? PE_FINISHED : PE_PHASE_CHANGE, p);
+	}
+
+	float dir = (p->sign < 0) ? -1.0f : 1.0f;
+	if (p->watch_armed && (p->watch_position - p->position) * dir <= 0.0f)
+	{
+		p->watch_armed = false;
+		motion_emit(PE_POSITION_REACHED, p);
+	}
+}
+
 
 void motion_reset_drive_system(void)
 {
 	motors_stop_all();
 
 	encoder_odometry_reset();
+	motors_reset_steps();
 	profile_reset(&motionType.forward);
 	profile_reset(&motionType.rotation);
+	motion_busy = false;
 
 	motors_enable_all(true);
+	drivers_released = false;
+}
+
+/* Segment boundary: new bases for odometry and steps, fresh profiles. The
+   drivers stay enabled and the step clock keeps running, so a CL57T never
+   loses holding torque between commands; only after motion_stop() does
+   this fall back to the full reset that re-enables them. */
+void motion_begin_segment(void)
+{
+	if (drivers_released)
+	{
+		motion_reset_drive_system();
+		return;
+	}
+
+	encoder_odometry_reset();
+	motors_reset_steps();
+	profile_reset(&motionType.forward);
+	profile_reset(&motionType.rotation);
+	motion_busy = false;
+}
+
+/* drop the active profiles without touching the drivers (fault stop) */
+void motion_abort(void)
+{
+	profile_reset(&motionType.forward);
+	profile_reset(&motionType.rotation);
+	motion_busy = false;
 }
 
 void profile_soft_reset(Profile *p)
@@ -148,11 +351,16 @@ void profile_soft_reset(Profile *p)
 void motion_SOFT_reset_drive_system(void)
 {
 	encoder_odometry_reset();
+	motors_reset_steps();
 	profile_soft_reset(&motionType.forward);
 	profile_soft_reset(&motionType.rotation);
 }
 
-void motion_stop(void) { motors_stop_all(); }
+void motion_stop(void)
+{
+	motors_stop_all();
+	drivers_released = true;
+}
 
 float motion_position(void) { return motionType.forward.position; }
 float motion_velocity(void) { return motionType.forward.speed; }
@@ -164,6 +372,9 @@ float motion_angle(void) { return motionType.rotation.position; }
 float motion_omega(void) { return motionType.rotation.speed; }
 float motion_alpha(void) { return motionType.rotation.acceleration; }
 
+const ProfilePlan *motion_move_plan(void) { return &motionType.forward.plan; }
+const ProfilePlan *motion_turn_plan(void) { return &motionType.rotation.plan; }
+
 bool motion_move_finished(void)      { return motionType.forward.state == PS_FINISHED; }
 bool motion_turn_finished(void) { return motionType.rotation.state == PS_FINISHED; }
 
@@ -171,30 +382,55 @@ void motion_start_move(float distance, float top_v, float final_v, float acc)
 {
 	motionType.forward.kind = PK_FORWARD;  // Add this line
 	profile_start(&motionType.forward, distance, top_v, final_v, acc);
+	motion_busy = true;
 }
 
 void motion_start_turn(float distance, float top_w, float final_w, float acc)
 {
 	motionType.rotation.kind = PK_ROTATION;  // Add this line
 	profile_start(&motionType.rotation, distance, top_w, final_w, acc);
+	motion_busy = true;
 }
 
 void motion_update(void)
 {
+	PROF_BEGIN(PROF_MOTION);
+
 	profile_update(&motionType.forward);
 	profile_update(&motionType.rotation);
-}
 
+	profile_dispatch(&motionType.forward);
+	profile_dispatch(&motionType.rotation);
 
-void motion_wait_until_position(float position_mm)
-{
-	while (motion_position() < position_mm)
+	/* cleared before the callback so the handler may start the next segment */
+	if (motion_busy && profile_done(&motionType.forward) && profile_done(&motionType.rotation))
 	{
-		_delay_ms(LOOP_TIME);
+		motion_busy = false;
+		motion_emit(PE_MOTION_COMPLETE, 0);
 	}
+
+	PROF_END(PROF_MOTION);
+}
+
+void motion_set_settling(bool enable) { settle_enabled = enable; }
+
+void motion_set_limit_scale(float acc_scale, float speed_scale)
+{
+	if (acc_scale < 0.05f)
+		acc_scale = 0.05f; /* never stall a profile completely */
+	limit_acc_scale = acc_scale;
+	limit_inv_acc_scale = 1.0f / acc_scale;
+	limit_speed_scale = speed_scale;
+}
+void motion_set_event_handler(ProfileEventHandler handler) { event_handler = handler; }
+
+void motion_notify_at_position(float position_mm)
+{
+	motionType.forward.watch_position = position_mm;
+	motionType.forward.watch_armed = true;
 }
 
-void motion_wait_until_distance(float distance_mm)
+void motion_notify_after_distance(float distance_mm)
 {
-	motion_wait_until_position(motion_position() + distance_mm);
+	motion_notify_at_position(motion_position() + distance_mm);
 }
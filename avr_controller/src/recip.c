@@ -0,0 +1,81 @@
+/* -----------------------------------------------------------------------------
+ * recip.c  Reciprocals without a divide
+ *
+ * AVR has no divide instruction: a 32-bit __udivmodsi4 or a float division
+ * costs several hundred cycles. Here den is shifted until its leading one
+ * sits at bit 31. The 8 bits below it select an entry of a 257-entry Q31
+ * table of 1/x on [1, 2), built at compile time, and the next 16 bits
+ * interpolate linearly. That is within 3 ppm. A quotient then costs one
+ * 32x32->64 multiply and a shift.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include "recip.h"
+
+/* 1/x at x = 1 + i/256, lowered by half the chord error h^2/(4x^3) so the
+   interpolation error is centred on zero instead of always high        */
+#define RECIP_X(i)    (256.0 / (256.0 + (i)))
+#define RECIP_Q31(i)  ((uint32_t)(2147483648.0 * (RECIP_X(i) - RECIP_X(i) * RECIP_X(i) * RECIP_X(i) / 524288.0) + 0.5))
+
+#define R1(i)   RECIP_Q31(i),
+#define R4(i)   R1(i) R1((i) + 1) R1((i) + 2) R1((i) + 3)
+#define R16(i)  R4(i) R4((i) + 4) R4((i) + 8) R4((i) + 12)
+#define R64(i)  R16(i) R16((i) + 16) R16((i) + 32) R16((i) + 48)
+
+static const uint32_t recip_table[257] PROGMEM = {
+	R64(0) R64(64) R64(128) R64(192) RECIP_Q31(256)
+};
+
+Recip recip(uint32_t den)
+{
+	Recip r = { 0, 62 };
+	if (den == 0)
+		return r;
+
+	/* leading one to bit 31, a byte at a time first */
+	while (!(den & 0xFF000000UL))
+	{
+		den <<= 8;
+		r.shift -= 8;
+	}
+	while (!(den & 0x80000000UL))
+	{
+		den <<= 1;
+		r.shift--;
+	}
+
+	uint8_t  i = (uint8_t)(den >> 23);  /* 8 bits below the leading one */
+	uint16_t f = (uint16_t)(den >> 7);  /* next 16 bits */
+	uint32_t y0 = pgm_read_dword(&recip_table[i]);
+	uint32_t d = y0 - pgm_read_dword(&recip_table[i + 1]);
+
+	r.y = y0 - ((d * (f >> 8) + ((d * (f & 0xFF)) >> 8)) >> 8);
+	return r;
+}
+
+uint16_t isqrt32(uint32_t x)
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit)
+	{
+		if (x >= root + bit)
+		{
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint16_t)root;
+}
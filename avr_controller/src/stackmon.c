@@ -0,0 +1,55 @@
+/* -----------------------------------------------------------------------------
+ * stackmon.c  Stack painting and RAM high-water mark
+ *
+ * stack_paint() runs from .init1, before the C runtime has set up r1, so it
+ * is naked assembly with no stack use. The hardware reset leaves SP at
+ * RAMEND, and everything from _end (end of .bss) to there is filled with
+ * STACK_PAINT.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include <avr/io.h>
+#include "stackmon.h"
+
+#define STACK_PAINT 0xC5
+
+/* linker symbols */
+extern uint8_t __data_start, __data_end;
+extern uint8_t __bss_start, __bss_end;
+extern uint8_t _end, __stack;
+
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
+
+void stack_paint(void)
+{
+	__asm volatile(
+		"    ldi r30, lo8(_end)      \n"
+		"    ldi r31, hi8(_end)      \n"
+		"    ldi r24, %0             \n"
+		"    ldi r25, hi8(__stack)   \n"
+		"    rjmp 2f                 \n"
+		"1:  st Z+, r24              \n"
+		"2:  cpi r30, lo8(__stack)   \n"
+		"    cpc r31, r25            \n"
+		"    brlo 1b                 \n"
+		"    breq 1b                 \n"
+		:: "M"(STACK_PAINT));
+}
+
+void stackmon_report(StackReport *r)
+{
+	const uint8_t *p = &_end;
+	const uint8_t *top = &__stack;
+
+	/* the stack grows down towards _end: the first overwritten byte from
+	   below is the deepest point it ever reached */
+	while (p <= top && *p == STACK_PAINT)
+		p++;
+
+	r->data = (uint16_t)(&__data_end - &__data_start);
+	r->bss = (uint16_t)(&__bss_end - &__bss_start);
+	r->free_min = (uint16_t)(p - &_end);
+	r->stack_max = (uint16_t)(top - p + 1);
+	r->ram = (uint16_t)(RAMEND - RAMSTART + 1);
+}
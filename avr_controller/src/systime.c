@@ -1,68 +1,81 @@
 /*
- *  systime.c    64-bit, 1-s time base using Timer/Counter 0
+ *  systime.c  -  1-us time base using Timer/Counter 3
  * ATmega32U4, F_CPU = 16 000 000 Hz
  *
  * Created: 7/2/2025 12:04:55 PM
  *  Author: Endeavor360
  *
  *
- * Timer-0 setup
- *    normal (free-running) mode
- *    prescaler 8  ?  clk/8 = 2 MHz  ?  0.5 s per tick
- *    overflow every 256 ticks  ?  128 s  ?  ISR ? 7 812 Hz
+ * Timer-3 setup
+ *   - normal (free-running) mode, no output pins
+ *   - prescaler /8  ->  clk/8 = 2 MHz  ->  0.5 us per tick
+ *   - overflow every 65 536 ticks  ->  32.768 ms  ->  ISR at 30.5 Hz
+ *
+ * The 16-bit counter carries the fast bits, so the software extension only
+ * counts overflows. Timer 0 used to do this at 8 bits and took a 64-bit
+ * increment every 128 us (7 812 Hz); see README for the CPU share.
  */
 
 #include "systime.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include "irqmon.h"
 
-/* 0.5 s  2?? ? 9.210? s ? 2.910? years */
-static volatile uint64_t _ovf64 = 0ULL;
+/* 32.768 ms x 2^32 -> 4.5 years */
+volatile uint32_t systime_ovf32 = 0UL;
 
 /* ---------- initialisation ---------- */
 void systime_init(void)
 {
     cli();                       /* global IRQs off                     */
-    TCCR0A = 0;                  /* normal counting mode                */
-    TCCR0B = _BV(CS01);          /* CS01:0 = 010 ? prescaler 8         */
-    TIMSK0 = _BV(TOIE0);         /* enable overflow interrupt           */
+    TCCR3A = 0;                  /* normal counting mode                */
+    TCCR3B = _BV(CS31);          /* CS32:0 = 010 -> prescaler /8        */
+    TCNT3  = 0;
+    TIFR3  = _BV(TOV3);          /* drop a stale overflow               */
+    TIMSK3 = _BV(TOIE3);         /* enable overflow interrupt           */
     sei();                       /* back on                             */
 }
 
-/* ---------- overflow ISR (every 128 s) ---------- */
-ISR(TIMER0_OVF_vect)
-{
-    _ovf64++;                    /* software high-word                  */
-}
-
-/* ---------- atomic 64-bit read helper ---------- */
-static inline uint64_t atomic64(volatile uint64_t *p)
+/* ---------- overflow ISR (every 32.768 ms) ---------- */
+ISR(TIMER3_OVF_vect)
 {
-    uint64_t v;
-    uint8_t s = SREG; cli();
-    v = *p;
-    SREG = s;
-    return v;
+    systime_ovf32++;             /* software high-word                  */
 }
 
-/* ---------- 1-s timestamp ---------- */
-uint64_t micros64(void)
+/* ---------- overflow count and TCNT3 as one consistent pair ---------- */
+static inline uint32_t snapshot(uint16_t *tcnt)
 {
-    uint64_t ovf;
-    uint8_t  tcnt;
+    uint32_t ovf;
+    uint16_t t;
 
     uint8_t s = SREG; cli();            /* critical section             */
-    ovf  = _ovf64;
-    tcnt = TCNT0;
+    uint16_t t0 = irqmon_begin();
+    ovf = systime_ovf32;
+    t   = TCNT3;
 
-    /* if overflow happened after reading TCNT0 but before cli() */
-    if ((TIFR0 & _BV(TOV0)) && tcnt < 255)
+    /* wrapped but the ISR has not run yet: the flag is still pending */
+    if ((TIFR3 & _BV(TOV3)) && t < 0x8000U)
         ovf++;
 
+    irqmon_end(IRQ_TIME, t0);
     SREG = s;                           /* restore                       */
 
-    /* total half-s ticks = (ovf << 8) | tcnt
-       divide by 2 ? shift right once to get whole s                */
-    uint64_t half_us = (ovf << 8) | tcnt;
-    return half_us >> 1;
+    *tcnt = t;
+    return ovf;
+}
+
+/* ---------- 1-us timestamps ---------- */
+/* one overflow is 65 536 half-us = 32 768 us */
+uint32_t micros32(void)
+{
+    uint16_t tcnt;
+    uint32_t ovf = snapshot(&tcnt);
+    return (ovf << 15) + (tcnt >> 1);
+}
+
+uint64_t micros64(void)
+{
+    uint16_t tcnt;
+    uint32_t ovf = snapshot(&tcnt);
+    return ((uint64_t)ovf << 15) + (tcnt >> 1);
 }
@@ -0,0 +1,53 @@
+/* -----------------------------------------------------------------------------
+ * trace.c  One-shot event capture
+ *
+ * Recording itself is inline (trace.h); this file holds the buffer and
+ * prints it for the TRACE service command. Timestamps go out as 24-bit
+ * 0.5 us ticks (8.4 s wrap, far longer than a capture); the host tool
+ * unwraps them.
+ *
+ * Author   : Endeavor360
+ * ---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include "trace.h"
+#include "prof.h"
+
+TraceEvent       trace_buf[TRACE_LEN];
+volatile uint8_t trace_len = 0;
+volatile uint8_t trace_state = TRACE_ARMED; /* capture the first tick after boot */
+
+static const char *const trace_marks[TR_MARK_COUNT] = {
+	[TR_TICK]   = "TICK",
+	[TR_CMD_RX] = "CMD_RX",
+	[TR_USB_TX] = "USB_TX",
+};
+
+uint8_t trace_stop(void)
+{
+	uint8_t s = SREG; cli();
+	trace_state = TRACE_IDLE;
+	uint8_t n = trace_len;
+	SREG = s;
+	return n;
+}
+
+int trace_format(uint8_t i, char *buf, size_t n)
+{
+	const TraceEvent *e = &trace_buf[i];
+	unsigned long ticks = ((unsigned long)e->ovf << 16) | e->t;
+
+	if (e->id >= TR_SPAN)
+		return snprintf(buf, n, "TRACE %lu X %s %u\r\n", ticks, prof_name(e->id - TR_SPAN), e->val);
+
+	return snprintf(buf, n, "TRACE %lu I %s %u\r\n", ticks,
+					e->id < TR_MARK_COUNT ? trace_marks[e->id] : "?", e->val);
+}
+
+void trace_arm(void)
+{
+	uint8_t s = SREG; cli();
+	trace_len = 0;
+	trace_state = TRACE_ARMED;
+	SREG = s;
+}
@@ -57,6 +57,20 @@ def build_command(cmd: Tuple[float, float, int, int, int, int, float, float]) ->
     """Format exactly as parse_jetson_auto() expects on the MCU."""
     return f"{cmd[0]},{cmd[1]},{cmd[2]},{cmd[3]},{cmd[4]},{cmd[5]},{cmd[6]},{cmd[7]}\n"
 
+def parse_ack(line: str):
+    """
+    MCU answers every autonomous command with
+    "ACK T=<s> F <ok> <tri> <vpk> <ta> <tc> <tb> R <ok> <tri> <vpk> <ta> <tc> <tb>".
+    Returns (predicted_seconds, forward_feasible, rotation_feasible) or None.
+    """
+    parts = line.strip().split()
+    if len(parts) != 16 or parts[0] != "ACK" or not parts[1].startswith("T="):
+        return None
+    try:
+        return float(parts[1][2:]), parts[3] == "1", parts[10] == "1"
+    except ValueError:
+        return None
+
 def parse_telemetry(line: str):
     """
     MCU sends 12 space-separated fields; last two are emerg and profileDone.
@@ -93,6 +107,13 @@ def main() -> None:
                     text = raw.decode("ascii", errors="replace").rstrip()
                     print(f"< {text}")   # echo to console
 
+                    ack = parse_ack(text)
+                    if ack:
+                        eta, fwd_ok, rot_ok = ack
+                        print(f"[INFO] MCU predicts completion in {eta:.2f} s")
+                        if not (fwd_ok and rot_ok):
+                            print("[WARN] Final speed not reachable for this segment")
+
                     pkt = parse_telemetry(text)
                     if pkt:
                         if pkt["emerg"]:
@@ -0,0 +1,172 @@
+/*
+ * trace_to_chrome.cpp - turn a TRACE dump from the AVR controller into
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+ *
+ * Capture: send "TRACE" once to arm, again after a tick to dump, and save
+ * the reply (e.g. with listen_serial.py). Lines the tool does not know are
+ * skipped, so the whole serial log can be fed in.
+ *
+ * Build:  g++ -std=c++17 -O2 -o trace_to_chrome trace_to_chrome.cpp
+ * Usage:  ./trace_to_chrome dump.txt > tick.json
+ *         ./trace_to_chrome < dump.txt > tick.json
+ *
+ * Dump lines:  TRACE <ticks> X <probe> <duration>   span, ticks at its end
+ *              TRACE <ticks> I <mark>  <arg>        instant
+ * ticks are Timer 3 counts (0.5 us) modulo 2^24.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kTickWrap = 1u << 24;
+
+struct Event
+{
+	bool        span;
+	std::string name;
+	uint64_t    end_ticks; // unwrapped
+	uint32_t    val;
+};
+
+std::string json_escape(const std::string &s)
+{
+	std::string out;
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out;
+}
+
+// marks carry a small argument; CMD_RX's is the first character of the line
+std::string mark_args(const Event &e)
+{
+	std::ostringstream a;
+	if (e.name == "CMD_RX" && e.val >= 0x20 && e.val < 0x7F)
+		a << "{\"first\": \"" << json_escape(std::string(1, (char)e.val)) << "\"}";
+	else
+		a << "{\"arg\": " << e.val << "}";
+	return a.str();
+}
+
+std::vector<Event> read_dump(std::istream &in)
+{
+	std::vector<Event> events;
+	std::string line;
+	// Unwrapped time of the latest event so far. It starts one range in, so
+	// an event a little before the first one stays positive.
+	uint64_t latest = kTickWrap;
+	bool first = true;
+
+	while (std::getline(in, line))
+	{
+		std::istringstream f(line);
+		std::string tag, kind, name;
+		uint32_t ticks = 0, val = 0;
+
+		if (!(f >> tag >> ticks >> kind >> name >> val) || tag != "TRACE")
+			continue; // "TRACE END n", telemetry, anything else
+		if (kind != "X" && kind != "I")
+			continue;
+
+		ticks &= kTickWrap - 1;
+		// Spans are logged at their end, so an ISR that ends between the
+		// enclosing span's end stamp and its trace_put() comes first with a
+		// later time. Only a step back of more than half the range is a wrap.
+		uint64_t at = latest;
+		if (first)
+			at += ticks;
+		else
+		{
+			uint32_t delta = (ticks - static_cast<uint32_t>(latest)) & (kTickWrap - 1);
+			if (delta < kTickWrap / 2)
+				at += delta;
+			else
+				at -= kTickWrap - delta;
+		}
+		first = false;
+		if (at > latest)
+			latest = at;
+
+		events.push_back({kind == "X", name, at, val});
+	}
+	return events;
+}
+
+void write_json(const std::vector<Event> &events, std::ostream &out)
+{
+	// one CPU, so ISR spans nest inside the main-loop span they interrupted
+	out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+	out << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+		   "\"args\": {\"name\": \"ATmega32U4\"}}";
+
+	uint64_t t0 = events.empty() ? 0 : events.front().end_ticks;
+	for (const Event &e : events)
+	{
+		uint64_t start = e.span ? e.end_ticks - e.val : e.end_ticks;
+		if (start < t0)
+			t0 = start;
+	}
+
+	char num[32];
+	for (const Event &e : events)
+	{
+		out << ",\n  {\"name\": \"" << json_escape(e.name) << "\", \"pid\": 1, \"tid\": 1, ";
+		if (e.span)
+		{
+			uint64_t start = e.end_ticks - e.val - t0;
+			std::snprintf(num, sizeof(num), "%.1f", start * 0.5);
+			out << "\"ph\": \"X\", \"ts\": " << num;
+			std::snprintf(num, sizeof(num), "%.1f", e.val * 0.5);
+			out << ", \"dur\": " << num << "}";
+		}
+		else
+		{
+			std::snprintf(num, sizeof(num), "%.1f", (e.end_ticks - t0) * 0.5);
+			out << "\"ph\": \"i\", \"s\": \"t\", \"ts\": " << num
+				<< ", \"args\": " << mark_args(e) << "}";
+		}
+	}
+	out << "\n]}\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	std::vector<Event> events;
+
+	if (argc > 1)
+	{
+		std::ifstream in(argv[1]);
+		if (!in)
+		{
+			std::cerr << "trace_to_chrome: cannot open " << argv[1] << "\n";
+			return 1;
+		}
+		events = read_dump(in);
+	}
+	else
+	{
+		events = read_dump(std::cin);
+	}
+
+	if (events.empty())
+	{
+		std::cerr << "trace_to_chrome: no TRACE lines found\n";
+		return 1;
+	}
+
+	write_json(events, std::cout);
+	std::cerr << "trace_to_chrome: " << events.size() << " events\n";
+	return 0;
+}